@@ -0,0 +1,318 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <general_balanced_tree_c.h>
+
+/*---------------------------------------------*/
+/* Micro-benchmarks. Run with the name of one  */
+/* benchmark, or none to run them all. A       */
+/* second argument is passed to the benchmark. */
+/*---------------------------------------------*/
+
+static double Seconds(const clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* A bijection on unsigned 32-bit values, to insert keys in random order. */
+static gbt_ky_type Scatter(const unsigned long i) {
+  return (gbt_ky_type)((i * 2654435761UL) & 0x7fffffffUL);
+}
+
+static const char *const kernel_names[] = {"skew", "flatten"};
+
+/*---------------------------------------------*/
+/* gbt_balance of a whole tree, many times for */
+/* small trees, and sorted insertion, which    */
+/* keeps rebuilding subtrees on the right      */
+/* spine, for both rebuild kernels.            */
+/*---------------------------------------------*/
+
+static int BenchRebuild(const char *arg) {
+  const size_t sizes[] = {15, 127, 1023, 65535, 1048575, 4194303};
+  size_t s;
+  int kernel;
+
+  (void)arg;
+  puts("rebuild: ns per node rebuilt by gbt_balance");
+  for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    const size_t n = sizes[s];
+    const size_t reps = n < (1UL << 23) ? (1UL << 23) / n : 1;
+    struct gbt_dict *const D = gbt_construct_dict();
+    size_t i;
+
+    if (!D)
+      return EXIT_FAILURE;
+    for (i = 0; i < n; i++)
+      gbt_insert(D, Scatter(i), (gbt_data_type)i);
+    printf("  %8lu nodes:", (unsigned long)n);
+    for (kernel = GBT_REBUILD_SKEW; kernel <= GBT_REBUILD_FLATTEN; kernel++) {
+      clock_t start;
+      gbt_set_rebuild_kernel(D, kernel);
+      gbt_balance(D);
+      start = clock();
+      for (i = 0; i < reps; i++)
+        gbt_balance(D);
+      printf("  %s %6.2f", kernel_names[kernel],
+             Seconds(start) * 1e9 / ((double)n * (double)reps));
+    }
+    putchar('\n');
+    gbt_destruct_dict(D);
+  }
+
+  puts("rebuild: ns per sorted gbt_insert (partial rebuilds)");
+  for (kernel = GBT_REBUILD_SKEW; kernel <= GBT_REBUILD_FLATTEN; kernel++) {
+    const size_t n = 1UL << 20;
+    struct gbt_dict *const D = gbt_construct_dict();
+    clock_t start;
+    size_t i;
+
+    if (!D)
+      return EXIT_FAILURE;
+    gbt_set_rebuild_kernel(D, kernel);
+    start = clock();
+    for (i = 0; i < n; i++)
+      gbt_insert(D, (gbt_ky_type)i, (gbt_data_type)i);
+    printf("  %s %6.2f\n", kernel_names[kernel],
+           Seconds(start) * 1e9 / (double)n);
+    gbt_destruct_dict(D);
+  }
+  return EXIT_SUCCESS;
+}
+
+static long Height(const struct gbt_node *const t) {
+  long l, r;
+  if (!t)
+    return 0;
+  l = Height(t->left);
+  r = Height(t->right);
+  return 1 + (l > r ? l : r);
+}
+
+/*---------------------------------------------*/
+/* Scattered insertion up to arg keys (10^9 by */
+/* default, about 32GB), reporting the height  */
+/* against the bound from gbt_minweight and    */
+/* the insert cost at every power of two.      */
+/*---------------------------------------------*/
+
+static int BenchScale(const char *arg) {
+  const unsigned long n = arg ? strtoul(arg, NULL, 10) : 1000000000UL;
+  struct gbt_dict *const D = gbt_construct_dict();
+  unsigned long i, next = 1UL << 16, last = 0;
+  clock_t start;
+
+  if (!D)
+    return EXIT_FAILURE;
+  if (n > 0x80000000UL) { /* Scatter is a bijection on 31 bits */
+    gbt_destruct_dict(D);
+    return EXIT_FAILURE;
+  }
+  printf("scale: %lu scattered keys, GBT_MAXHEIGHT %d\n", n,
+         (int)GBT_MAXHEIGHT);
+  puts("        keys  height  bound  ns/insert");
+  start = clock();
+  for (i = 0; i < n; i++) {
+    if (!gbt_insert(D, Scatter(i), (gbt_data_type)i))
+      break;
+    if (i + 1 == next || i + 1 == n) {
+      const double t = Seconds(start);
+      long bound = 1;
+      while (bound < GBT_MAXHEIGHT && gbt_minweight[bound + 1] <= D->weight)
+        bound++;
+      printf("  %10lu  %6ld  %5ld  %9.1f\n", i + 1, Height(D->t), bound,
+             t * 1e9 / (double)(i + 1 - last));
+      last = i + 1;
+      next <<= 1;
+      start = clock();
+    }
+  }
+  if (i < n)
+    printf("  out of memory after %lu keys\n", i);
+  gbt_destruct_dict(D);
+  return i < n ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*---------------------------------------------*/
+/* gbt_lookup of absent keys, with and without */
+/* the membership filter.                      */
+/*---------------------------------------------*/
+
+static int BenchFilter(const char *arg) {
+  const unsigned long n = arg ? strtoul(arg, NULL, 10) : 1UL << 20;
+  struct gbt_dict *const D = gbt_construct_dict();
+  struct gbt_filter_stats s;
+  unsigned long i, found;
+  int on;
+
+  if (!D)
+    return EXIT_FAILURE;
+  for (i = 0; i < n; i++)
+    gbt_insert(D, Scatter(2 * i), (gbt_data_type)i);
+  puts("filter: ns per gbt_lookup of an absent key");
+  for (on = 0; on <= 1; on++) {
+    clock_t start;
+    if (!gbt_set_filter(D, on))
+      break;
+    found = 0;
+    start = clock();
+    for (i = 0; i < n; i++)
+      found += gbt_lookup(D, Scatter(2 * i + 1)) != NULL;
+    gbt_filter_stats(D, &s);
+    printf("  %-3s %6.1f", on ? "on" : "off", Seconds(start) * 1e9 / (double)n);
+    if (on)
+      printf("  %lu bytes, fp rate %.4f estimated, %.4f observed",
+             (unsigned long)s.bytes, s.fp_rate,
+             (double)(s.queries - s.negatives) / (double)s.queries);
+    putchar('\n');
+  }
+  gbt_destruct_dict(D);
+  return found ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*---------------------------------------------*/
+/* gbt_lookup of keys drawn from a Zipf        */
+/* distribution (exponent arg, 1 by default)   */
+/* for several cache sizes, in a tree that     */
+/* fits in the CPU caches and in one that      */
+/* does not.                                   */
+/*---------------------------------------------*/
+
+static int Zipf(const unsigned long n, const double exponent) {
+  const unsigned long m = 1UL << 22;
+  const size_t sizes[] = {0, 256, 4096, 65536};
+  struct gbt_dict *const D = gbt_construct_dict();
+  double *const cdf = malloc(n * sizeof(*cdf));
+  gbt_ky_type *const queries = malloc(m * sizeof(*queries));
+  unsigned long i, lo, hi, seed = 12345, sum;
+  size_t s;
+  int rc = EXIT_SUCCESS;
+
+  if (!D || !cdf || !queries) {
+    free(queries);
+    free(cdf);
+    if (D)
+      gbt_destruct_dict(D);
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < n; i++) {
+    gbt_insert(D, Scatter(i), (gbt_data_type)i);
+    cdf[i] = (i ? cdf[i - 1] : 0.0) + pow((double)(i + 1), -exponent);
+  }
+  for (i = 0; i < m; i++) { /* rank i + 1 is key Scatter(i) */
+    const double u = cdf[n - 1] * (double)(seed >> 8) / 16777216.0;
+    seed = (seed * 1103515245UL + 12345UL) & 0xffffffffUL;
+    for (lo = 0, hi = n - 1; lo < hi;)
+      if (cdf[(lo + hi) / 2] < u)
+        lo = (lo + hi) / 2 + 1;
+      else
+        hi = (lo + hi) / 2;
+    queries[i] = Scatter(lo);
+  }
+
+  printf("  %lu keys\n", n);
+  for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    struct gbt_cache_stats st;
+    clock_t start;
+    if (!gbt_set_cache(D, sizes[s])) {
+      rc = EXIT_FAILURE;
+      break;
+    }
+    sum = 0;
+    start = clock();
+    for (i = 0; i < m; i++)
+      sum += (unsigned long)*gbt_infoval(D, gbt_lookup(D, queries[i]));
+    gbt_cache_stats(D, &st);
+    printf("  %8lu slots %6.1f", (unsigned long)sizes[s],
+           Seconds(start) * 1e9 / (double)m);
+    if (sizes[s])
+      printf("  hit rate %.3f",
+             (double)st.hits / (double)(st.hits + st.misses));
+    printf("  (%lu)\n", sum % 10);
+  }
+  free(queries);
+  free(cdf);
+  gbt_destruct_dict(D);
+  return rc;
+}
+
+static int BenchZipf(const char *arg) {
+  const double exponent = arg ? atof(arg) : 1.0;
+
+  printf("zipf: ns per gbt_lookup, exponent %.2f\n", exponent);
+  if (Zipf(1UL << 16, exponent) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  return Zipf(1UL << 20, exponent);
+}
+
+/*---------------------------------------------*/
+/* Draining a dictionary in key order: walking */
+/* the left spine and calling gbt_delete,      */
+/* against gbt_pop_min.                        */
+/*---------------------------------------------*/
+
+static int BenchQueue(const char *arg) {
+  const unsigned long n = arg ? strtoul(arg, NULL, 10) : 1UL << 20;
+  int pop;
+
+  puts("queue: ns per remove-earliest");
+  for (pop = 0; pop <= 1; pop++) {
+    struct gbt_dict *const D = gbt_construct_dict();
+    struct gbt_node *t;
+    clock_t start;
+    unsigned long i;
+
+    if (!D)
+      return EXIT_FAILURE;
+    for (i = 0; i < n; i++)
+      gbt_insert(D, Scatter(i), (gbt_data_type)i);
+    start = clock();
+    for (i = 0; i < n; i++)
+      if (pop)
+        gbt_pop_min(D, NULL, NULL);
+      else {
+        for (t = D->t; t->left;)
+          t = t->left;
+        gbt_delete(D, t->key);
+      }
+    printf("  %-19s %6.1f\n", pop ? "gbt_pop_min" : "spine + gbt_delete",
+           Seconds(start) * 1e9 / (double)n);
+    if (gbt_size(D))
+      return EXIT_FAILURE;
+    gbt_destruct_dict(D);
+  }
+  return EXIT_SUCCESS;
+}
+
+struct bench {
+  const char *name;
+  int (*run)(const char *arg);
+};
+
+static const struct bench benches[] = {{"rebuild", BenchRebuild},
+                                       {"scale", BenchScale},
+                                       {"filter", BenchFilter},
+                                       {"zipf", BenchZipf},
+                                       {"queue", BenchQueue}};
+
+int main(int argc, char *argv[]) {
+  size_t i;
+  int rc = EXIT_SUCCESS, ran = 0;
+
+  for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    if (argc < 2 || strcmp(argv[1], benches[i].name) == 0) {
+      ran = 1;
+      if (benches[i].run(argc > 2 ? argv[2] : NULL) != EXIT_SUCCESS)
+        rc = EXIT_FAILURE;
+    }
+  if (!ran) {
+    fprintf(stderr, "usage: %s [", argv[0]);
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+      fprintf(stderr, "%s%s", i ? "|" : "", benches[i].name);
+    fputs("]\n", stderr);
+    return EXIT_FAILURE;
+  }
+  return rc;
+}
@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "gbt_compact.h"
+#include "gbt_handle.h"
+
+#define GBT_HANDLE_MAX ((gbt_handle)-1)
+
+#ifdef GBT_COMPACT_SOA
+#define KEY(D, h) ((D)->keys[h])
+#else
+#define KEY(D, h) ((D)->nodes[h].key)
+#endif /* GBT_COMPACT_SOA */
+#define LEFT(D, h) ((D)->nodes[h].left)
+#define RIGHT(D, h) ((D)->nodes[h].right)
+
+/*---------------- Rebalancing ------------------*/
+
+/* The pool as the shared handle kernel sees it. */
+static struct gbt_handle_tree compact_Tree(struct gbt_compact_dict *const D) {
+  struct gbt_handle_tree T;
+
+  T.nodes = D->nodes;
+  T.stride = sizeof(*D->nodes);
+  T.scratch = NULL;
+  return T;
+}
+
+static void compact_PerfectBalance(struct gbt_compact_dict *const D,
+                                   gbt_handle *const t, const size_t w) {
+  const struct gbt_handle_tree T = compact_Tree(D);
+
+  gbt_HandleBalance(&T, t, w);
+}
+
+/*-------------- pool -------------------------*/
+
+static int compact_Fits(const size_t n, const size_t size) {
+  return n <= GBT_SIZE_MAX / size;
+}
+
+/* Make sure one more node fits without moving the pool during a descent. */
+static int compact_Reserve(struct gbt_compact_dict *const D) {
+  gbt_handle capacity;
+  void *p;
+
+  if (D->freelist || D->used + 1 < D->capacity)
+    return 1;
+  if (D->capacity > GBT_HANDLE_MAX / 2)
+    return 0;
+  capacity = D->capacity ? D->capacity * 2 : 16;
+  /* the handle bound does not bound the bytes where size_t is 32 bits */
+  if (!compact_Fits(capacity, sizeof(*D->nodes)) ||
+#ifdef GBT_COMPACT_SOA
+      !compact_Fits(capacity, sizeof(*D->keys)) ||
+#endif /* GBT_COMPACT_SOA */
+      !compact_Fits(capacity, sizeof(*D->data)))
+    return 0;
+
+  p = realloc(D->nodes, capacity * sizeof(*D->nodes));
+  if (!p)
+    return 0;
+  D->nodes = p;
+#ifdef GBT_COMPACT_SOA
+  p = realloc(D->keys, capacity * sizeof(*D->keys));
+  if (!p)
+    return 0;
+  D->keys = p;
+#endif /* GBT_COMPACT_SOA */
+  p = realloc(D->data, capacity * sizeof(*D->data));
+  if (!p)
+    return 0;
+  D->data = p;
+  D->capacity = capacity;
+  return 1;
+}
+
+static gbt_handle compact_NewNode(struct gbt_compact_dict *const D,
+                                  const gbt_ky_type key,
+                                  const gbt_data_type val) {
+  gbt_handle h;
+
+  if (D->freelist) {
+    h = D->freelist;
+    D->freelist = LEFT(D, h);
+  } else
+    h = ++D->used;
+  LEFT(D, h) = RIGHT(D, h) = GBT_NIL;
+  memset(&KEY(D, h), 0, sizeof(KEY(D, h)));
+  memset(&D->data[h], 0, sizeof(D->data[h]));
+  D->key_assign(&KEY(D, h), key);
+  D->assign(&D->data[h], val);
+  return h;
+}
+
+static void compact_FreeNode(struct gbt_compact_dict *const D,
+                             const gbt_handle h) {
+  if (D->key_destroy)
+    D->key_destroy(KEY(D, h));
+  LEFT(D, h) = D->freelist;
+  D->freelist = h;
+}
+
+/*-------------- construction -------------------*/
+
+struct gbt_compact_dict *gbt_compact_construct_dict(void) {
+  return gbt_compact_construct_dict_full(
+      gbt_default_key_assign, gbt_default_key_less, gbt_default_key_equal,
+      gbt_default_assign, gbt_default_key_destroy, gbt_default_key_print);
+}
+
+struct gbt_compact_dict *gbt_compact_construct_dict_full(
+    const gbt_ky_assign_func key_assign_func,
+    const gbt_ky_less_func key_less_than_func,
+    const gbt_ky_equal_func key_equal_func, const gbt_assign_func assign_func,
+    const gbt_key_destroy_func key_destroy_func,
+    const gbt_key_print_func key_print_func) {
+  struct gbt_compact_dict *p;
+
+  gbt_InitGlobal();
+  p = calloc(1, sizeof(*p));
+  if (!p)
+    return NULL;
+  p->t = GBT_NIL;
+  p->weight = 1;
+  p->numofdeletions = 0;
+
+  p->key_assign =
+      key_assign_func == NULL ? gbt_default_key_assign : key_assign_func;
+  p->key_less =
+      key_less_than_func == NULL ? gbt_default_key_less : key_less_than_func;
+  p->key_equal =
+      key_equal_func == NULL ? gbt_default_key_equal : key_equal_func;
+  p->assign = assign_func == NULL ? gbt_default_assign : assign_func;
+  p->key_destroy =
+      key_destroy_func == NULL ? gbt_default_key_destroy : key_destroy_func;
+  p->key_print =
+      key_print_func == NULL ? gbt_default_key_print : key_print_func;
+
+  return p;
+}
+
+/*-------------- dictionary operations ----------*/
+
+gbt_handle gbt_compact_insert(struct gbt_compact_dict *const D,
+                              const gbt_ky_type key, const gbt_data_type in) {
+  gbt_handle *path[GBT_MAXHEIGHT + 1], h, candidate;
+  long d1;
+
+  if (!compact_Reserve(D))
+    return GBT_NIL;
+  d1 = 1;
+  path[1] = &(D->t);
+  candidate = GBT_NIL;
+  while (*path[d1]) {
+    h = *path[d1];
+    if (D->key_less(key, KEY(D, h))) {
+      path[d1 + 1] = &LEFT(D, h);
+    } else {
+      if (D->key_equal(key, KEY(D, h)))
+        candidate = h;
+      path[d1 + 1] = &RIGHT(D, h);
+    }
+    d1++;
+  }
+  if (candidate)
+    return candidate;
+  h = compact_NewNode(D, key, in);
+  *path[d1] = h;
+  D->weight++;
+  if (D->weight < (size_t)(gbt_minweight[d1])) {
+    const struct gbt_handle_tree T = compact_Tree(D);
+    gbt_HandleFixPath(&T, path, d1);
+  }
+  return h;
+}
+
+gbt_handle gbt_compact_lookup(struct gbt_compact_dict *const D,
+                              const gbt_ky_type key) {
+  gbt_handle t = D->t;
+  while (t) {
+    if (D->key_equal(key, KEY(D, t)))
+      return t;
+    else if (D->key_less(key, KEY(D, t)))
+      t = LEFT(D, t);
+    else
+      t = RIGHT(D, t);
+  }
+  return GBT_NIL;
+}
+
+void gbt_compact_delete(struct gbt_compact_dict *const D,
+                        const gbt_ky_type key) {
+  gbt_handle *candidate, *last = NULL, tmp, victim, *t;
+
+  t = &(D->t);
+  candidate = NULL;
+  while (*t) {
+    last = t;
+    if (D->key_less(key, KEY(D, *t)))
+      t = &LEFT(D, *t);
+    else {
+      candidate = t;
+      t = &RIGHT(D, *t);
+    }
+  }
+  if (candidate && (D->key_equal(KEY(D, *candidate), key))) {
+    D->numofdeletions++;
+    D->weight--;
+    tmp = *last;
+    if (candidate == last) {
+      *last = LEFT(D, *last);
+      compact_FreeNode(D, tmp);
+    } else {
+      *last = RIGHT(D, *last);
+      victim = *candidate;
+      RIGHT(D, tmp) = RIGHT(D, victim);
+      LEFT(D, tmp) = LEFT(D, victim);
+      compact_FreeNode(D, victim);
+      *candidate = tmp;
+    }
+  }
+  if (D->numofdeletions > GBT_MAXDEL * D->weight && D->weight > 3) {
+    compact_PerfectBalance(D, &(D->t), D->weight);
+    D->numofdeletions = 0;
+  }
+}
+
+gbt_ky_type gbt_compact_keyval(struct gbt_compact_dict *const D,
+                               const gbt_handle item) {
+  return KEY(D, item);
+}
+
+gbt_data_type *gbt_compact_infoval(struct gbt_compact_dict *const D,
+                                   const gbt_handle item) {
+  return &D->data[item];
+}
+
+size_t gbt_compact_size(struct gbt_compact_dict *const D) {
+  return D->weight - 1;
+}
+
+size_t gbt_compact_memory(struct gbt_compact_dict *const D) {
+  return (size_t)D->capacity * (sizeof(*D->nodes) +
+#ifdef GBT_COMPACT_SOA
+                                sizeof(*D->keys) +
+#endif /* GBT_COMPACT_SOA */
+                                sizeof(*D->data));
+}
+
+void gbt_compact_balance(struct gbt_compact_dict *const D) {
+  if (D->t)
+    compact_PerfectBalance(D, &(D->t), D->weight);
+  D->numofdeletions = 0;
+}
+
+static void compact_ClearTree(struct gbt_compact_dict *const D,
+                              const gbt_handle t) {
+  if (!t)
+    return;
+  compact_ClearTree(D, RIGHT(D, t));
+  compact_ClearTree(D, LEFT(D, t));
+
+  if (D->key_destroy)
+    D->key_destroy(KEY(D, t));
+}
+
+void gbt_compact_clear(struct gbt_compact_dict *const D) {
+  compact_ClearTree(D, D->t);
+  free(D->nodes);
+#ifdef GBT_COMPACT_SOA
+  free(D->keys);
+  D->keys = NULL;
+#endif /* GBT_COMPACT_SOA */
+  free(D->data);
+  D->nodes = NULL;
+  D->data = NULL;
+  D->t = GBT_NIL;
+  D->capacity = D->used = D->freelist = 0;
+  D->weight = 1;
+  D->numofdeletions = 0;
+}
+
+void gbt_compact_destruct_dict(struct gbt_compact_dict *const D) {
+  gbt_compact_clear(D);
+  free(D);
+}
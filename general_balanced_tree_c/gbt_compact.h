@@ -0,0 +1,126 @@
+#ifndef GBT_COMPACT_H
+#define GBT_COMPACT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "general_balanced_tree_c.h"
+
+/*----- Compact dictionaries ------------------------
+
+The same general balanced tree, but nodes live in one growable pool
+array and children are 32-bit indices into it rather than pointers.
+Keys sit next to the links; data lives in a side table, so a search
+only touches links and keys. Define GBT_COMPACT_SOA to move the keys
+into a side table of their own as well (useful for large keys).
+
+With an int key and long data a node takes 20 bytes on 64-bit builds,
+against 32 for struct gbt_node.
+
+The pool is reallocated as it grows, so references are handed out as
+gbt_handle indices, which stay valid until their key is deleted.
+Handle GBT_NIL (0) means "no node".
+
+struct gbt_compact_dict * gbt_compact_construct_dict()
+   Generates a new compact dictionary.
+
+gbt_handle gbt_compact_insert (struct gbt_compact_dict * D,
+                gbt_ky_type key, data_type in)
+   Insert key and data, returns a handle (GBT_NIL when out of memory).
+
+gbt_handle gbt_compact_lookup (struct gbt_compact_dict * D,
+                gbt_ky_type key)
+   Returns a handle, or GBT_NIL.
+
+void gbt_compact_delete (struct gbt_compact_dict * D, gbt_ky_type key)
+   Delete key (and data)
+
+ky_type gbt_compact_keyval (struct gbt_compact_dict * D, gbt_handle item)
+data_type *gbt_compact_infoval (struct gbt_compact_dict * D,
+                gbt_handle item)
+   Get key / a pointer to data via handle. The pointer is only valid
+   until the next insertion.
+
+size_t gbt_compact_size (struct gbt_compact_dict * D)
+size_t gbt_compact_memory (struct gbt_compact_dict * D)
+   Number of stored items, and bytes held by the pool.
+
+void gbt_compact_balance (struct gbt_compact_dict * D)
+void gbt_compact_clear (struct gbt_compact_dict * D)
+void gbt_compact_destruct_dict (struct gbt_compact_dict * D)
+
+---------------------------------------------------*/
+
+typedef unsigned int gbt_handle; /* 32 bits on every supported target */
+
+#define GBT_NIL 0
+
+struct gbt_compact_node {
+  gbt_handle left, right; /* left doubles as the free list link */
+#ifndef GBT_COMPACT_SOA
+  gbt_ky_type key;
+#endif /* !GBT_COMPACT_SOA */
+};
+
+struct gbt_compact_dict {
+  struct gbt_compact_node *nodes; /* nodes[0] is never used */
+#ifdef GBT_COMPACT_SOA
+  gbt_ky_type *keys;
+#endif /* GBT_COMPACT_SOA */
+  gbt_data_type *data;
+  gbt_handle t;
+  gbt_handle capacity, used, freelist;
+  size_t weight, numofdeletions;
+
+  gbt_ky_assign_func key_assign;
+  gbt_ky_less_func key_less;
+  gbt_ky_equal_func key_equal;
+  gbt_assign_func assign;
+  gbt_key_destroy_func key_destroy;
+  gbt_key_print_func key_print;
+};
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_compact_dict *
+gbt_compact_construct_dict_full(gbt_ky_assign_func, gbt_ky_less_func,
+                                gbt_ky_equal_func, gbt_assign_func,
+                                gbt_key_destroy_func, gbt_key_print_func);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_compact_dict *
+gbt_compact_construct_dict(void);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT gbt_handle
+gbt_compact_insert(struct gbt_compact_dict *, gbt_ky_type, gbt_data_type);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT gbt_handle
+gbt_compact_lookup(struct gbt_compact_dict *, gbt_ky_type);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_compact_delete(struct gbt_compact_dict *, gbt_ky_type);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT gbt_ky_type
+gbt_compact_keyval(struct gbt_compact_dict *, gbt_handle);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT gbt_data_type *
+gbt_compact_infoval(struct gbt_compact_dict *, gbt_handle);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT size_t
+gbt_compact_size(struct gbt_compact_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT size_t
+gbt_compact_memory(struct gbt_compact_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_compact_balance(struct gbt_compact_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_compact_clear(struct gbt_compact_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_compact_destruct_dict(struct gbt_compact_dict *);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !GBT_COMPACT_H */
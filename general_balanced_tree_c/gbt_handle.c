@@ -0,0 +1,158 @@
+#include <stddef.h>
+
+#include "gbt_handle.h"
+
+#define LEFT(T, h) GBT_HLEFT(T, h)
+#define RIGHT(T, h) GBT_HRIGHT(T, h)
+
+/*---------------- Rebalancing ------------------*/
+
+/* These mirror leftrot, rightrot, Skew, Split, */
+/* gbt_Flatten, Link and gbt_FixBalance, with   */
+/* handles for pointers.                        */
+
+static void handle_leftrot(const struct gbt_handle_tree *const T,
+                           gbt_handle *const t) {
+  gbt_handle tmp;
+
+  tmp = *t;
+  *t = RIGHT(T, *t);
+  RIGHT(T, tmp) = LEFT(T, *t);
+  LEFT(T, *t) = tmp;
+}
+
+static void handle_rightrot(const struct gbt_handle_tree *const T,
+                            gbt_handle *const t) {
+  gbt_handle tmp;
+
+  tmp = *t;
+  *t = LEFT(T, *t);
+  LEFT(T, tmp) = RIGHT(T, *t);
+  RIGHT(T, *t) = tmp;
+}
+
+static void handle_Skew(const struct gbt_handle_tree *const T, gbt_handle *t) {
+  do {
+    while (LEFT(T, *t))
+      handle_rightrot(T, t);
+    t = &RIGHT(T, *t);
+  } while (*t);
+}
+
+static void handle_Split(const struct gbt_handle_tree *const T, gbt_handle *t,
+                         const size_t p1, const size_t p2) {
+  const size_t incr = p1 - p2;
+  size_t count = 0;
+  size_t i;
+
+  for (i = p2; i > 0; i--) {
+    count += incr;
+    if (count >= p2) {
+      handle_leftrot(T, t);
+      count -= p2; /* incr <= p2 */
+    }
+    t = &RIGHT(T, *t);
+  }
+}
+
+static size_t handle_Flatten(const struct gbt_handle_tree *const T,
+                             gbt_handle t) {
+  gbt_handle stack[GBT_MAXHEIGHT + 1];
+  long top;
+  size_t n;
+
+  n = 0;
+  top = 0;
+  stack[0] = GBT_NIL;
+  for (;;) {
+    while (t) {
+      GBT_PUSH(t);
+      t = LEFT(T, t);
+    }
+    if (!top)
+      break;
+    GBT_POP(t);
+    T->scratch[n++] = t;
+    t = RIGHT(T, t);
+  }
+  return n;
+}
+
+static gbt_handle handle_Link(const struct gbt_handle_tree *const T,
+                              const gbt_handle *const a, const size_t n) {
+  const size_t mid = n / 2;
+
+  if (n == 0)
+    return GBT_NIL;
+  LEFT(T, a[mid]) = handle_Link(T, a, mid);
+  RIGHT(T, a[mid]) = handle_Link(T, a + mid + 1, n - mid - 1);
+  return a[mid];
+}
+
+void gbt_HandleBalance(const struct gbt_handle_tree *const T,
+                       gbt_handle *const t, const size_t w) {
+  size_t b;
+
+  if (T->scratch) {
+    *t = handle_Link(T, T->scratch, handle_Flatten(T, *t));
+    return;
+  }
+  handle_Skew(T, t);
+  b = 1;
+  while (b <= w)
+    b *= 2;
+  b /= 2;
+  if (b != w)
+    handle_Split(T, t, w - 1, b - 1);
+  while (b > 2) {
+    handle_Split(T, t, b - 1, b / 2 - 1);
+    b /= 2;
+  }
+}
+
+size_t gbt_HandleWeight(const struct gbt_handle_tree *const T, gbt_handle t) {
+  gbt_handle stack[GBT_MAXHEIGHT];
+  long top;
+  size_t w;
+
+  w = 1;
+  top = 0;
+  stack[0] = GBT_NIL;
+  while (t) {
+    while (LEFT(T, t)) {
+      w++;
+      if (RIGHT(T, t))
+        GBT_PUSH(RIGHT(T, t));
+      t = LEFT(T, t);
+    }
+    w++;
+    if (!RIGHT(T, t))
+      GBT_POP(t)
+    else
+      t = RIGHT(T, t);
+  }
+  return w;
+}
+
+void gbt_HandleFixPath(const struct gbt_handle_tree *const T,
+                       gbt_handle *const p[], const long d1) {
+  long d2;
+  size_t w;
+
+  if (d1 <= 1)
+    return;
+
+  d2 = d1;
+  w = 2;
+  do {
+    d2--;
+    if (d2 < 1)
+      break;
+    if (&LEFT(T, *p[d2]) == p[d2 + 1])
+      w = w + gbt_HandleWeight(T, RIGHT(T, *p[d2]));
+    else
+      w = w + gbt_HandleWeight(T, LEFT(T, *p[d2]));
+  } while (w >= gbt_minweight[d1 - d2 + 1]);
+  if (d2 >= 1)
+    gbt_HandleBalance(T, p[d2], w);
+}
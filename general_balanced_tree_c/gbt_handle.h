@@ -0,0 +1,54 @@
+#ifndef GBT_HANDLE_H
+#define GBT_HANDLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "gbt_compact.h"
+
+/*----- Handle tree kernel (internal) ---------------
+
+Rebalancing shared by the dictionaries whose nodes sit in an array and
+link by gbt_handle index (gbt_compact.c, gbt_shm.c). Neither the
+header nor its functions are part of the installed API.
+
+The kernel sees the node array through struct gbt_handle_tree: node h
+starts at nodes + h * stride, and every node struct must begin with
+its left and right handles, in that order.
+
+With a scratch buffer (room for every node of the largest subtree to
+rebuild), subtrees are rebuilt by flattening them into it and linking
+the middle out, which stores each link once. Without one they are
+rebuilt in place by Skew and Split.
+
+---------------------------------------------------*/
+
+struct gbt_handle_links {
+  gbt_handle left, right;
+};
+
+struct gbt_handle_tree {
+  void *nodes;
+  size_t stride;
+  gbt_handle *scratch; /* NULL: rebuild in place */
+};
+
+#define GBT_HLINKS(T, h)                                                       \
+  ((struct gbt_handle_links *)((char *)(T)->nodes + (size_t)(h) * (T)->stride))
+#define GBT_HLEFT(T, h) (GBT_HLINKS(T, h)->left)
+#define GBT_HRIGHT(T, h) (GBT_HLINKS(T, h)->right)
+
+extern size_t gbt_HandleWeight(const struct gbt_handle_tree *, gbt_handle);
+
+extern void gbt_HandleBalance(const struct gbt_handle_tree *, gbt_handle *,
+                              size_t);
+
+extern void gbt_HandleFixPath(const struct gbt_handle_tree *,
+                              gbt_handle *const[], long);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !GBT_HANDLE_H */
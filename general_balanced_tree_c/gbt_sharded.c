@@ -0,0 +1,271 @@
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION gbt_mutex;
+#define GBT_MUTEX_INIT(m) (InitializeCriticalSection(m), 0)
+#define GBT_MUTEX_DESTROY(m) DeleteCriticalSection(m)
+#define GBT_MUTEX_LOCK(m) EnterCriticalSection(m)
+#define GBT_MUTEX_UNLOCK(m) LeaveCriticalSection(m)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t gbt_mutex;
+#define GBT_MUTEX_INIT(m) pthread_mutex_init(m, NULL)
+#define GBT_MUTEX_DESTROY(m) pthread_mutex_destroy(m)
+#define GBT_MUTEX_LOCK(m) pthread_mutex_lock(m)
+#define GBT_MUTEX_UNLOCK(m) pthread_mutex_unlock(m)
+#endif /* _WIN32 */
+
+#include "gbt_sharded.h"
+
+struct gbt_shard {
+  gbt_mutex lock;
+  struct gbt_dict D; /* inline, so that it shares lines only with lock */
+};
+
+/* Keeps neighbouring shards off each other's cache lines. */
+union gbt_shard_slot {
+  struct gbt_shard s;
+  char pad[(sizeof(struct gbt_shard) + GBT_CACHELINE - 1) / GBT_CACHELINE *
+           GBT_CACHELINE];
+};
+
+struct gbt_sharded_dict {
+  union gbt_shard_slot *shards; /* GBT_CACHELINE aligned, inside block */
+  void *block;
+  size_t nshards;
+  gbt_ky_type *splits;    /* range mode: nshards - 1 keys */
+  gbt_key_hash_func hash; /* hash mode; NULL in range mode */
+};
+
+/*-------------- construction -------------------*/
+
+static void gbt_ShardedFree(struct gbt_sharded_dict *const S,
+                            const size_t ready, const size_t nsplits) {
+  size_t i;
+
+  if (S->splits) {
+    for (i = 0; i < nsplits; i++)
+      S->shards[0].s.D.key_destroy(S->splits[i]);
+    free(S->splits);
+  }
+  for (i = 0; i < ready; i++) {
+    GBT_MUTEX_DESTROY(&S->shards[i].s.lock);
+    gbt_FreeDict(&S->shards[i].s.D);
+  }
+  free(S->block);
+  free(S);
+}
+
+static struct gbt_sharded_dict *
+gbt_ShardedNew(const size_t nshards, const gbt_ky_assign_func key_assign_func,
+               const gbt_ky_less_func key_less_than_func,
+               const gbt_ky_equal_func key_equal_func,
+               const gbt_assign_func assign_func,
+               const gbt_key_destroy_func key_destroy_func,
+               const gbt_key_print_func key_print_func) {
+  struct gbt_sharded_dict *S;
+  size_t i, skew;
+
+  if (nshards < 1)
+    return NULL;
+  S = calloc(1, sizeof(*S));
+  if (!S)
+    return NULL;
+  S->block = malloc(nshards * sizeof(*S->shards) + GBT_CACHELINE);
+  if (!S->block) {
+    free(S);
+    return NULL;
+  }
+  skew = (size_t)S->block % GBT_CACHELINE;
+  S->shards = (union gbt_shard_slot *)((char *)S->block +
+                                       (skew ? GBT_CACHELINE - skew : 0));
+  S->nshards = nshards;
+  for (i = 0; i < nshards; i++) {
+    gbt_InitDict(&S->shards[i].s.D, key_assign_func, key_less_than_func,
+                 key_equal_func, assign_func, key_destroy_func,
+                 key_print_func);
+    if (GBT_MUTEX_INIT(&S->shards[i].s.lock) != 0) {
+      gbt_ShardedFree(S, i, 0);
+      return NULL;
+    }
+  }
+  return S;
+}
+
+struct gbt_sharded_dict *gbt_sharded_construct_range(
+    const gbt_ky_type *const splits, const size_t nsplits,
+    const gbt_ky_assign_func key_assign_func,
+    const gbt_ky_less_func key_less_than_func,
+    const gbt_ky_equal_func key_equal_func, const gbt_assign_func assign_func,
+    const gbt_key_destroy_func key_destroy_func,
+    const gbt_key_print_func key_print_func) {
+  struct gbt_sharded_dict *S;
+  struct gbt_dict *D;
+  size_t i;
+
+  S = gbt_ShardedNew(nsplits + 1, key_assign_func, key_less_than_func,
+                     key_equal_func, assign_func, key_destroy_func,
+                     key_print_func);
+  if (!S || !nsplits)
+    return S;
+  D = &S->shards[0].s.D;
+  S->splits = calloc(nsplits, sizeof(*S->splits));
+  if (!S->splits) {
+    gbt_ShardedFree(S, S->nshards, 0);
+    return NULL;
+  }
+  for (i = 0; i < nsplits; i++)
+    D->key_assign(&S->splits[i], splits[i]);
+  return S;
+}
+
+struct gbt_sharded_dict *gbt_sharded_construct_hash(
+    const size_t nshards, const gbt_key_hash_func hash,
+    const gbt_ky_assign_func key_assign_func,
+    const gbt_ky_less_func key_less_than_func,
+    const gbt_ky_equal_func key_equal_func, const gbt_assign_func assign_func,
+    const gbt_key_destroy_func key_destroy_func,
+    const gbt_key_print_func key_print_func) {
+  struct gbt_sharded_dict *const S =
+      gbt_ShardedNew(nshards, key_assign_func, key_less_than_func,
+                     key_equal_func, assign_func, key_destroy_func,
+                     key_print_func);
+
+  if (S)
+    S->hash = hash == NULL ? gbt_default_key_hash : hash;
+  return S;
+}
+
+/*-------------- dictionary operations ----------*/
+
+static size_t gbt_ShardIndex(struct gbt_sharded_dict *const S,
+                             const gbt_ky_type key) {
+  size_t lo, hi, mid;
+
+  if (S->hash)
+    return S->hash(key) % S->nshards;
+  lo = 0;
+  hi = S->nshards - 1;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (S->shards[0].s.D.key_less(key, S->splits[mid]))
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+#define GBT_SHARD(S, key) (&(S)->shards[gbt_ShardIndex(S, key)].s)
+
+int gbt_sharded_insert(struct gbt_sharded_dict *const S, const gbt_ky_type key,
+                       const gbt_data_type in) {
+  struct gbt_shard *const shard = GBT_SHARD(S, key);
+  struct gbt_node *node;
+  int created;
+
+  GBT_MUTEX_LOCK(&shard->lock);
+  node = gbt_insert_ex(&shard->D, key, in, &created);
+  GBT_MUTEX_UNLOCK(&shard->lock);
+  return node ? created : -1;
+}
+
+int gbt_sharded_upsert(struct gbt_sharded_dict *const S, const gbt_ky_type key,
+                       const gbt_data_type in) {
+  struct gbt_shard *const shard = GBT_SHARD(S, key);
+  struct gbt_node *node;
+  int created;
+
+  GBT_MUTEX_LOCK(&shard->lock);
+  node = gbt_upsert_ex(&shard->D, key, in, &created);
+  GBT_MUTEX_UNLOCK(&shard->lock);
+  return node ? created : -1;
+}
+
+int gbt_sharded_lookup(struct gbt_sharded_dict *const S, const gbt_ky_type key,
+                       gbt_data_type *const out) {
+  struct gbt_shard *const shard = GBT_SHARD(S, key);
+  struct gbt_node *node;
+
+  GBT_MUTEX_LOCK(&shard->lock);
+  node = gbt_lookup(&shard->D, key);
+  if (node && out)
+    *out = node->data;
+  GBT_MUTEX_UNLOCK(&shard->lock);
+  return node != NULL;
+}
+
+int gbt_sharded_delete(struct gbt_sharded_dict *const S, const gbt_ky_type key,
+                       gbt_data_type *const out) {
+  struct gbt_shard *const shard = GBT_SHARD(S, key);
+  int found;
+
+  GBT_MUTEX_LOCK(&shard->lock);
+  found = gbt_delete_get(&shard->D, key, out);
+  GBT_MUTEX_UNLOCK(&shard->lock);
+  return found;
+}
+
+int gbt_sharded_foreach(struct gbt_sharded_dict *const S,
+                        const gbt_visit_func visit, void *const ctx) {
+  size_t i;
+  int rc = 0;
+
+  for (i = 0; i < S->nshards && !rc; i++) {
+    GBT_MUTEX_LOCK(&S->shards[i].s.lock);
+    rc = gbt_foreach(&S->shards[i].s.D, visit, ctx);
+    GBT_MUTEX_UNLOCK(&S->shards[i].s.lock);
+  }
+  return rc;
+}
+
+int gbt_sharded_foreach_range(struct gbt_sharded_dict *const S,
+                              const gbt_ky_type lo, const gbt_ky_type hi,
+                              const gbt_visit_func visit, void *const ctx) {
+  size_t i, first, last;
+  int rc = 0;
+
+  if (S->hash) {
+    first = 0;
+    last = S->nshards - 1;
+  } else { /* only the shards overlapping [lo, hi) */
+    first = gbt_ShardIndex(S, lo);
+    last = gbt_ShardIndex(S, hi);
+  }
+  for (i = first; i <= last && !rc; i++) {
+    GBT_MUTEX_LOCK(&S->shards[i].s.lock);
+    rc = gbt_foreach_range(&S->shards[i].s.D, lo, hi, visit, ctx);
+    GBT_MUTEX_UNLOCK(&S->shards[i].s.lock);
+  }
+  return rc;
+}
+
+size_t gbt_sharded_size(struct gbt_sharded_dict *const S) {
+  size_t i, n = 0;
+
+  for (i = 0; i < S->nshards; i++) {
+    GBT_MUTEX_LOCK(&S->shards[i].s.lock);
+    n += gbt_size(&S->shards[i].s.D);
+    GBT_MUTEX_UNLOCK(&S->shards[i].s.lock);
+  }
+  return n;
+}
+
+size_t gbt_sharded_shards(struct gbt_sharded_dict *const S) {
+  return S->nshards;
+}
+
+void gbt_sharded_clear(struct gbt_sharded_dict *const S) {
+  size_t i;
+
+  for (i = 0; i < S->nshards; i++) {
+    GBT_MUTEX_LOCK(&S->shards[i].s.lock);
+    gbt_clear(&S->shards[i].s.D);
+    GBT_MUTEX_UNLOCK(&S->shards[i].s.lock);
+  }
+}
+
+void gbt_sharded_destruct_dict(struct gbt_sharded_dict *const S) {
+  gbt_ShardedFree(S, S->nshards, S->hash ? 0 : S->nshards - 1);
+}
@@ -0,0 +1,116 @@
+#ifndef GBT_SHARDED_H
+#define GBT_SHARDED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "general_balanced_tree_c.h"
+
+#ifndef GBT_CACHELINE
+#define GBT_CACHELINE 64 /* Shards are padded to this size. */
+#endif                   /* !GBT_CACHELINE */
+
+/*----- Sharded dictionaries ------------------------
+
+Keys are partitioned across N ordinary struct gbt_dict, each behind its
+own lock, so writers to different shards never wait on each other
+(nor on a rebuild in another shard). Every shard sits on its own cache
+lines.
+
+In range mode shard i holds splits[i - 1] <= key < splits[i], so
+walking the shards in turn yields every key in order. In hash mode a
+key goes to shard hash(key) % N; walks then visit shard by shard and
+are only ordered within a shard.
+
+Since another thread may delete a key at any time, no references are
+handed out: data is copied into *out instead (a shallow copy).
+
+struct gbt_sharded_dict * gbt_sharded_construct_range (
+                const gbt_ky_type * splits, size_t nsplits, ...)
+   nsplits + 1 shards; splits must be strictly increasing.
+
+struct gbt_sharded_dict * gbt_sharded_construct_hash (size_t nshards,
+                gbt_key_hash_func hash, ...)
+   hash may be NULL for gbt_default_key_hash.
+
+   Both take the six functions of gbt_construct_dict_full last.
+
+int gbt_sharded_insert (struct gbt_sharded_dict * S, gbt_ky_type key,
+                data_type in)
+int gbt_sharded_upsert (struct gbt_sharded_dict * S, gbt_ky_type key,
+                data_type in)
+   Return 1 if a node was created, 0 if key was present, -1 when out of
+   memory. gbt_sharded_upsert overwrites the data of a present key.
+
+int gbt_sharded_lookup (struct gbt_sharded_dict * S, gbt_ky_type key,
+                data_type * out)
+int gbt_sharded_delete (struct gbt_sharded_dict * S, gbt_ky_type key,
+                data_type * out)
+   Return 1 if key was present (copying its data to out, if non-NULL).
+
+int gbt_sharded_foreach (struct gbt_sharded_dict * S,
+                gbt_visit_func visit, void * ctx)
+int gbt_sharded_foreach_range (struct gbt_sharded_dict * S,
+                gbt_ky_type lo, gbt_ky_type hi, gbt_visit_func visit,
+                void * ctx)
+   As gbt_foreach/gbt_foreach_range over all shards. visit runs with the
+   lock of the item's shard held and must not call back into S.
+
+size_t gbt_sharded_size (struct gbt_sharded_dict * S)
+size_t gbt_sharded_shards (struct gbt_sharded_dict * S)
+void gbt_sharded_clear (struct gbt_sharded_dict * S)
+void gbt_sharded_destruct_dict (struct gbt_sharded_dict * S)
+
+---------------------------------------------------*/
+
+struct gbt_sharded_dict;
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_sharded_dict *
+gbt_sharded_construct_range(const gbt_ky_type *, size_t, gbt_ky_assign_func,
+                            gbt_ky_less_func, gbt_ky_equal_func,
+                            gbt_assign_func, gbt_key_destroy_func,
+                            gbt_key_print_func);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_sharded_dict *
+gbt_sharded_construct_hash(size_t, gbt_key_hash_func, gbt_ky_assign_func,
+                           gbt_ky_less_func, gbt_ky_equal_func,
+                           gbt_assign_func, gbt_key_destroy_func,
+                           gbt_key_print_func);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_sharded_insert(struct gbt_sharded_dict *, gbt_ky_type, gbt_data_type);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_sharded_upsert(struct gbt_sharded_dict *, gbt_ky_type, gbt_data_type);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_sharded_lookup(struct gbt_sharded_dict *, gbt_ky_type, gbt_data_type *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_sharded_delete(struct gbt_sharded_dict *, gbt_ky_type, gbt_data_type *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_sharded_foreach(struct gbt_sharded_dict *, gbt_visit_func, void *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_sharded_foreach_range(struct gbt_sharded_dict *, gbt_ky_type, gbt_ky_type,
+                          gbt_visit_func, void *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT size_t
+gbt_sharded_size(struct gbt_sharded_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT size_t
+gbt_sharded_shards(struct gbt_sharded_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_sharded_clear(struct gbt_sharded_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_sharded_destruct_dict(struct gbt_sharded_dict *);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !GBT_SHARDED_H */
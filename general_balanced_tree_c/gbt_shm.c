@@ -0,0 +1,483 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L /* shm_open, ftruncate */
+#endif /* !_WIN32 && !_POSIX_C_SOURCE */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif /* _WIN32 */
+
+#include "gbt_handle.h"
+#include "gbt_shm.h"
+#include "gbt_shm_layout.h"
+
+#define GBT_HANDLE_MAX ((gbt_handle)-1)
+
+/* Orders the sequence number against node accesses, for the compiler */
+/* and the CPU alike.                                                 */
+#if defined(__GNUC__) || defined(__clang__)
+#define GBT_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#elif defined(_MSC_VER)
+#define GBT_BARRIER() MemoryBarrier()
+#else
+#error "gbt_shm.c needs a memory barrier for this compiler"
+#endif
+
+static const char gbt_shm_magic[8] = {'G', 'B', 'T', 'S', 'H', 'M', '0', '1'};
+
+struct gbt_shm_dict {
+  struct gbt_shm_header *head; /* start of the mapping */
+  struct gbt_shm_node *nodes;
+  size_t bytes;
+  struct gbt_handle_tree tree; /* tree.scratch is NULL in readers */
+  gbt_ky_less_func key_less;
+  gbt_ky_equal_func key_equal;
+#ifdef _WIN32
+  HANDLE mapping;
+#endif /* _WIN32 */
+};
+
+#define LEFT(D, h) ((D)->nodes[h].left)
+#define RIGHT(D, h) ((D)->nodes[h].right)
+#define KEY(D, h) ((D)->nodes[h].key)
+
+/*-------------- sequence lock ------------------*/
+
+static unsigned long gbt_SeqLoad(const struct gbt_shm_dict *const D) {
+  unsigned long seq;
+
+  GBT_BARRIER();
+  seq = *(volatile const unsigned long *)&D->head->seq;
+  GBT_BARRIER();
+  return seq;
+}
+
+static void gbt_SeqStore(struct gbt_shm_dict *const D,
+                         const unsigned long seq) {
+  GBT_BARRIER();
+  *(volatile unsigned long *)&D->head->seq = seq;
+  GBT_BARRIER();
+}
+
+#define GBT_SHM_BEGIN(D) gbt_SeqStore(D, (D)->head->seq + 1)
+#define GBT_SHM_END(D) gbt_SeqStore(D, (D)->head->seq + 1)
+
+#define GBT_SHM_SPINS 64 /* checks before a waiting reader yields */
+
+static void gbt_Yield(void) {
+#ifdef _WIN32
+  SwitchToThread();
+#else
+  sched_yield();
+#endif /* _WIN32 */
+}
+
+/*----------------------------------------*/
+/* Wait until no update is under way, and */
+/* return the (even) sequence number. A   */
+/* live writer moves the number on; one   */
+/* that stays odd and unchanged for       */
+/* GBT_SHM_PATIENCE yields belongs to a   */
+/* writer that died mid-update, and is    */
+/* returned as it is.                     */
+/*----------------------------------------*/
+
+static unsigned long gbt_SeqBegin(const struct gbt_shm_dict *const D) {
+  unsigned long seq, last;
+  long waited = 0;
+
+  seq = gbt_SeqLoad(D);
+  while ((seq & 1) && waited < GBT_SHM_SPINS + GBT_SHM_PATIENCE) {
+    if (waited++ >= GBT_SHM_SPINS)
+      gbt_Yield();
+    last = seq;
+    seq = gbt_SeqLoad(D);
+    if (seq != last)
+      waited = 0;
+  }
+  return seq;
+}
+
+/*-------------- mapping ------------------------*/
+
+static size_t shm_Bytes(const size_t capacity) {
+  return sizeof(union gbt_shm_head) +
+         (capacity + 1) * sizeof(struct gbt_shm_node);
+}
+
+static struct gbt_shm_dict *shm_Wrap(void *const base, const size_t bytes,
+                                     const gbt_ky_less_func less,
+                                     const gbt_ky_equal_func equal) {
+  struct gbt_shm_dict *p;
+
+  p = calloc(1, sizeof(*p));
+  if (!p)
+    return NULL;
+  p->head = (struct gbt_shm_header *)base;
+  p->nodes =
+      (struct gbt_shm_node *)((char *)base + sizeof(union gbt_shm_head));
+  p->bytes = bytes;
+  p->tree.nodes = p->nodes;
+  p->tree.stride = sizeof(*p->nodes);
+  p->key_less = less == NULL ? gbt_default_key_less : less;
+  p->key_equal = equal == NULL ? gbt_default_key_equal : equal;
+  return p;
+}
+
+static void shm_Unmap(struct gbt_shm_dict *const D) {
+#ifdef _WIN32
+  UnmapViewOfFile(D->head);
+  CloseHandle(D->mapping);
+#else
+  munmap((void *)D->head, D->bytes);
+#endif /* _WIN32 */
+}
+
+struct gbt_shm_dict *gbt_shm_create(const char *const name,
+                                    const size_t capacity,
+                                    const gbt_ky_less_func less,
+                                    const gbt_ky_equal_func equal) {
+  struct gbt_shm_dict *p;
+  size_t bytes;
+  void *base;
+#ifdef _WIN32
+  HANDLE mapping;
+#else
+  int fd;
+#endif /* _WIN32 */
+
+  if (capacity == 0 || capacity >= GBT_HANDLE_MAX ||
+      capacity >= (GBT_SIZE_MAX - sizeof(union gbt_shm_head)) /
+                      sizeof(struct gbt_shm_node))
+    return NULL;
+  gbt_InitGlobal();
+  bytes = shm_Bytes(capacity);
+
+#ifdef _WIN32
+  mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                               (DWORD)(bytes >> 16 >> 16), (DWORD)bytes,
+                               name);
+  if (mapping == NULL)
+    return NULL;
+  if (GetLastError() == ERROR_ALREADY_EXISTS) {
+    CloseHandle(mapping);
+    return NULL;
+  }
+  base = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, bytes);
+  if (base == NULL) {
+    CloseHandle(mapping);
+    return NULL;
+  }
+#else
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    return NULL;
+  if (ftruncate(fd, (off_t)bytes) != 0) {
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+  base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    shm_unlink(name);
+    return NULL;
+  }
+#endif /* _WIN32 */
+
+  /* The scratch buffer selects the flatten + Link rebuild: fewer stores */
+  /* mean fewer reader retries.                                         */
+  p = shm_Wrap(base, bytes, less, equal);
+  if (p)
+    p->tree.scratch = malloc(capacity * sizeof(*p->tree.scratch));
+  if (!p || !p->tree.scratch) {
+#ifdef _WIN32
+    UnmapViewOfFile(base);
+    CloseHandle(mapping);
+#else
+    munmap(base, bytes);
+    shm_unlink(name);
+#endif /* _WIN32 */
+    free(p);
+    return NULL;
+  }
+#ifdef _WIN32
+  p->mapping = mapping;
+#endif /* _WIN32 */
+
+  p->head->seq = 0;
+  p->head->node_size = sizeof(struct gbt_shm_node);
+  p->head->capacity = capacity;
+  p->head->t = p->head->used = p->head->freelist = GBT_NIL;
+  p->head->weight = 1;
+  p->head->numofdeletions = 0;
+  GBT_BARRIER();
+  memcpy(p->head->magic, gbt_shm_magic, sizeof(gbt_shm_magic));
+  return p;
+}
+
+struct gbt_shm_dict *gbt_shm_open(const char *const name,
+                                  const gbt_ky_less_func less,
+                                  const gbt_ky_equal_func equal) {
+  const struct gbt_shm_header *h;
+  struct gbt_shm_dict *p;
+  size_t bytes;
+  void *base;
+#ifdef _WIN32
+  MEMORY_BASIC_INFORMATION info;
+  HANDLE mapping;
+
+  gbt_InitGlobal();
+  mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+  if (mapping == NULL)
+    return NULL;
+  base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (base == NULL || VirtualQuery(base, &info, sizeof(info)) == 0) {
+    if (base != NULL)
+      UnmapViewOfFile(base);
+    CloseHandle(mapping);
+    return NULL;
+  }
+  bytes = info.RegionSize;
+#else
+  struct stat st;
+  int fd;
+
+  gbt_InitGlobal();
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < shm_Bytes(0)) {
+    close(fd);
+    return NULL;
+  }
+  bytes = (size_t)st.st_size;
+  base = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return NULL;
+#endif /* _WIN32 */
+
+  p = shm_Wrap(base, bytes, less, equal);
+#ifdef _WIN32
+  if (p)
+    p->mapping = mapping;
+#endif /* _WIN32 */
+  if (!p) {
+#ifdef _WIN32
+    UnmapViewOfFile(base);
+    CloseHandle(mapping);
+#else
+    munmap(base, bytes);
+#endif /* _WIN32 */
+    return NULL;
+  }
+
+  /* The writer may still be filling in the header. */
+  h = p->head;
+  GBT_BARRIER();
+  if (memcmp(h->magic, gbt_shm_magic, sizeof(gbt_shm_magic)) != 0 ||
+      h->node_size != sizeof(struct gbt_shm_node) || h->capacity == 0 ||
+      h->capacity >= GBT_HANDLE_MAX || bytes < shm_Bytes(h->capacity)) {
+    gbt_shm_close(p);
+    return NULL;
+  }
+  return p;
+}
+
+/*-------------- dictionary operations ----------*/
+
+static gbt_handle shm_NewNode(struct gbt_shm_dict *const D,
+                              const gbt_ky_type key,
+                              const gbt_data_type val) {
+  gbt_handle h;
+
+  if (D->head->freelist) {
+    h = D->head->freelist;
+    D->head->freelist = LEFT(D, h);
+  } else
+    h = ++D->head->used;
+  LEFT(D, h) = RIGHT(D, h) = GBT_NIL;
+  KEY(D, h) = key;
+  D->nodes[h].data = val;
+  return h;
+}
+
+static void shm_FreeNode(struct gbt_shm_dict *const D, const gbt_handle h) {
+  LEFT(D, h) = D->head->freelist;
+  D->head->freelist = h;
+}
+
+int gbt_shm_insert(struct gbt_shm_dict *const D, const gbt_ky_type key,
+                   const gbt_data_type in) {
+  gbt_handle *path[GBT_MAXHEIGHT + 1], h;
+  long d1;
+
+  if (!D->tree.scratch)
+    return -1;
+  d1 = 1;
+  path[1] = &D->head->t;
+  while (*path[d1]) {
+    h = *path[d1];
+    if (D->key_less(key, KEY(D, h))) {
+      path[d1 + 1] = &LEFT(D, h);
+    } else {
+      if (D->key_equal(key, KEY(D, h)))
+        return 0;
+      path[d1 + 1] = &RIGHT(D, h);
+    }
+    d1++;
+  }
+  if (!D->head->freelist && D->head->used >= D->head->capacity)
+    return -1;
+
+  GBT_SHM_BEGIN(D);
+  h = shm_NewNode(D, key, in);
+  *path[d1] = h;
+  D->head->weight++;
+  if (D->head->weight < (size_t)(gbt_minweight[d1]))
+    gbt_HandleFixPath(&D->tree, path, d1);
+  GBT_SHM_END(D);
+  return 1;
+}
+
+int gbt_shm_delete(struct gbt_shm_dict *const D, const gbt_ky_type key) {
+  gbt_handle *candidate, *last = NULL, tmp, victim, *t;
+
+  if (!D->tree.scratch)
+    return -1;
+  t = &D->head->t;
+  candidate = NULL;
+  while (*t) {
+    last = t;
+    if (D->key_less(key, KEY(D, *t)))
+      t = &LEFT(D, *t);
+    else {
+      candidate = t;
+      t = &RIGHT(D, *t);
+    }
+  }
+  if (!candidate || !D->key_equal(KEY(D, *candidate), key))
+    return 0;
+
+  GBT_SHM_BEGIN(D);
+  D->head->numofdeletions++;
+  D->head->weight--;
+  tmp = *last;
+  if (candidate == last) {
+    *last = LEFT(D, *last);
+    shm_FreeNode(D, tmp);
+  } else {
+    *last = RIGHT(D, *last);
+    victim = *candidate;
+    RIGHT(D, tmp) = RIGHT(D, victim);
+    LEFT(D, tmp) = LEFT(D, victim);
+    shm_FreeNode(D, victim);
+    *candidate = tmp;
+  }
+  if (D->head->numofdeletions > GBT_MAXDEL * D->head->weight &&
+      D->head->weight > 3) {
+    gbt_HandleBalance(&D->tree, &D->head->t, D->head->weight);
+    D->head->numofdeletions = 0;
+  }
+  GBT_SHM_END(D);
+  return 1;
+}
+
+/*----------------------------------------*/
+/* Readers see the segment change under   */
+/* them, so every node is read through a  */
+/* volatile pointer and every index is    */
+/* checked. A search that meets an odd or */
+/* changed sequence number, a bad index   */
+/* or an impossible depth started during  */
+/* an update, and is retried.             */
+/*----------------------------------------*/
+
+int gbt_shm_lookup(struct gbt_shm_dict *const D, const gbt_ky_type key,
+                   gbt_data_type *const out) {
+  volatile const struct gbt_shm_header *const head = D->head;
+  volatile const struct gbt_shm_node *node;
+  const gbt_handle capacity = (gbt_handle)head->capacity;
+  gbt_ky_type k;
+  gbt_data_type data;
+  gbt_handle t;
+  unsigned long seq;
+  long depth;
+  int found;
+
+  for (;;) {
+    seq = gbt_SeqBegin(D);
+    if (seq & 1)
+      return -1;
+    found = 0;
+    t = head->t;
+    for (depth = 0; t && t <= capacity && depth <= GBT_MAXHEIGHT; depth++) {
+      node = &D->nodes[t];
+      k = node->key;
+      if (D->key_equal(key, k)) {
+        data = node->data;
+        found = 1;
+        break;
+      }
+      t = D->key_less(key, k) ? node->left : node->right;
+    }
+    if (gbt_SeqLoad(D) != seq)
+      continue;
+    if (!found && t)
+      continue; /* cannot happen without a concurrent update */
+    if (found && out)
+      *out = data;
+    return found;
+  }
+}
+
+size_t gbt_shm_size(struct gbt_shm_dict *const D) {
+  size_t weight;
+  unsigned long seq;
+
+  do {
+    seq = gbt_SeqBegin(D);
+    if (seq & 1)
+      return GBT_SIZE_MAX;
+    weight = ((volatile const struct gbt_shm_header *)D->head)->weight;
+  } while (gbt_SeqLoad(D) != seq);
+  return weight - 1;
+}
+
+size_t gbt_shm_memory(struct gbt_shm_dict *const D) { return D->bytes; }
+
+void gbt_shm_clear(struct gbt_shm_dict *const D) {
+  if (!D->tree.scratch)
+    return;
+  GBT_SHM_BEGIN(D);
+  D->head->t = D->head->used = D->head->freelist = GBT_NIL;
+  D->head->weight = 1;
+  D->head->numofdeletions = 0;
+  GBT_SHM_END(D);
+}
+
+void gbt_shm_close(struct gbt_shm_dict *const D) {
+  if (!D)
+    return;
+  shm_Unmap(D);
+  free(D->tree.scratch);
+  free(D);
+}
+
+int gbt_shm_unlink(const char *const name) {
+#ifdef _WIN32
+  (void)name;
+  return 0;
+#else
+  return shm_unlink(name);
+#endif /* _WIN32 */
+}
@@ -0,0 +1,115 @@
+#ifndef GBT_SHM_H
+#define GBT_SHM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "gbt_compact.h"
+
+/*----- Shared-memory dictionaries ------------------
+
+A general balanced tree kept in a named shared memory segment (POSIX
+shm_open, or a Windows file mapping), so that any number of processes
+can search one copy of it. Nodes sit in an array inside the segment
+and link to each other by gbt_handle index, as in compact
+dictionaries, so the segment may be mapped at a different address in
+every process.
+
+One process creates the segment and is its only writer. Readers map it
+read-only and never write to it; they search under a sequence lock:
+the writer makes the sequence number odd for the span of each update
+(including any rebuild), and a reader retries a search that overlapped
+an update. Readers bounds-check every index, so a torn search stays
+inside the segment.
+
+A reader that finds an update under way spins briefly, then yields
+the CPU. If the sequence number stays odd and unchanged for
+GBT_SHM_PATIENCE yields, the writer is taken to have died mid-update:
+the search fails with -1 (gbt_shm_size returns GBT_SIZE_MAX). Such a
+segment stays unusable, as the tree may be half rebuilt; unlink it
+and create a new one.
+
+The segment has a fixed capacity, chosen on creation. Keys and data
+are copied into it bytewise, so they must not hold pointers.
+
+struct gbt_shm_dict * gbt_shm_create (const char * name,
+                size_t capacity, gbt_ky_less_func less,
+                gbt_ky_equal_func equal)
+   Creates segment name (which must not exist yet) for up to capacity
+   items, and returns its writer. NULL comparators select the
+   defaults.
+
+struct gbt_shm_dict * gbt_shm_open (const char * name,
+                gbt_ky_less_func less, gbt_ky_equal_func equal)
+   Maps an existing segment for reading. Returns NULL if there is
+   none, or while its writer is still setting it up.
+
+int gbt_shm_insert (struct gbt_shm_dict * D, gbt_ky_type key,
+                data_type in)
+   Returns 1 if key was added, 0 if it was present, and -1 if the
+   segment is full or D is a reader.
+
+int gbt_shm_delete (struct gbt_shm_dict * D, gbt_ky_type key)
+   Returns 1 if key was removed, 0 if absent, -1 if D is a reader.
+
+int gbt_shm_lookup (struct gbt_shm_dict * D, gbt_ky_type key,
+                data_type * out)
+   Returns 1 if key is present, copying its data to out (if non-NULL),
+   0 if absent, and -1 if the writer died during an update.
+
+size_t gbt_shm_size (struct gbt_shm_dict * D)
+size_t gbt_shm_memory (struct gbt_shm_dict * D)
+   Number of stored items (GBT_SIZE_MAX if the writer died during an
+   update), and bytes in the segment.
+
+void gbt_shm_clear (struct gbt_shm_dict * D)
+   Remove everything (writer only).
+
+void gbt_shm_close (struct gbt_shm_dict * D)
+   Unmap the segment. It lives on until gbt_shm_unlink (on Windows,
+   until every process has closed it).
+
+int gbt_shm_unlink (const char * name)
+   Remove segment name. Returns 0 on success.
+
+---------------------------------------------------*/
+
+#ifndef GBT_SHM_PATIENCE
+#define GBT_SHM_PATIENCE 1000000L /* Yields a reader waits for a stuck */
+#endif                            /* update before giving up.          */
+
+struct gbt_shm_dict;
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_shm_dict *
+gbt_shm_create(const char *, size_t, gbt_ky_less_func, gbt_ky_equal_func);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_shm_dict *
+gbt_shm_open(const char *, gbt_ky_less_func, gbt_ky_equal_func);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_shm_insert(struct gbt_shm_dict *, gbt_ky_type, gbt_data_type);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int gbt_shm_delete(struct gbt_shm_dict *,
+                                                         gbt_ky_type);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_shm_lookup(struct gbt_shm_dict *, gbt_ky_type, gbt_data_type *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT size_t
+gbt_shm_size(struct gbt_shm_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT size_t
+gbt_shm_memory(struct gbt_shm_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void gbt_shm_clear(struct gbt_shm_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void gbt_shm_close(struct gbt_shm_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int gbt_shm_unlink(const char *);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !GBT_SHM_H */
@@ -0,0 +1,49 @@
+#ifndef GBT_SHM_LAYOUT_H
+#define GBT_SHM_LAYOUT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "gbt_compact.h"
+
+/*----- Shared-memory segment layout (internal) -----
+
+Used by gbt_shm.c, and by the tests that damage a segment on purpose.
+Not part of the installed API.
+
+The segment is a header, padded to a cache line, then capacity + 1
+nodes. Node 0 is never used, so GBT_NIL needs no special case.
+Everything is an index, never a pointer.
+
+---------------------------------------------------*/
+
+#ifndef GBT_CACHELINE
+#define GBT_CACHELINE 64
+#endif /* !GBT_CACHELINE */
+
+struct gbt_shm_header {
+  char magic[8];     /* written last, once the rest is valid */
+  unsigned long seq; /* odd while the writer is updating     */
+  size_t node_size, capacity;
+  gbt_handle t, used, freelist;
+  size_t weight, numofdeletions;
+};
+
+union gbt_shm_head {
+  struct gbt_shm_header h;
+  char pad[(sizeof(struct gbt_shm_header) + GBT_CACHELINE - 1) /
+           GBT_CACHELINE * GBT_CACHELINE];
+};
+
+struct gbt_shm_node {
+  gbt_handle left, right; /* left doubles as the free list link */
+  gbt_ky_type key;
+  gbt_data_type data;
+};
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !GBT_SHM_LAYOUT_H */
@@ -1,9 +1,15 @@
+#ifdef GBT_DEBUG
+#include <assert.h>
+#endif /* GBT_DEBUG */
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "general_balanced_tree_c.h"
 
+size_t gbt_minweight[GBT_MAXHEIGHT + 1];
+
 void gbt_default_key_assign(gbt_ky_type *dst, const gbt_ky_type src) {
   *dst = src;
 }
@@ -24,6 +30,165 @@ void gbt_default_key_destroy(const gbt_ky_type _) {}
 
 void gbt_default_key_print(const gbt_ky_type key) { printf("%d", key); }
 
+size_t gbt_default_key_hash(const gbt_ky_type key) {
+  unsigned long h = (unsigned long)key;
+
+  h ^= h >> 16;
+  h *= 0x45d9f3bUL;
+  h ^= h >> 16;
+  h *= 0x45d9f3bUL;
+  h ^= h >> 16;
+  return (size_t)h;
+}
+
+/*-------------- membership filter --------------*/
+
+/*----------------------------------------*/
+/* A blocked Bloom filter: a key sets     */
+/* GBT_FILTER_K bits of a single block,   */
+/* picked by its hash, so a test touches  */
+/* one cache line. The bits within the    */
+/* block come from an LCG seeded with the */
+/* hash. The number of blocks is kept odd */
+/* so the block does not just depend on   */
+/* the low bits of the hash.              */
+/*----------------------------------------*/
+
+#define GBT_FILTER_STEP(g) ((g) = ((g)*1103515245UL + 12345UL) & 0xffffffffUL)
+#define GBT_FILTER_BIT(g) (((g) >> 16) % (GBT_FILTER_BLOCK * 8))
+#define GBT_FILTER_MINKEYS 64
+
+static void gbt_FilterSet(struct gbt_filter *const f, const size_t h) {
+  unsigned char *const b = f->bits + (h % f->nblocks) * GBT_FILTER_BLOCK;
+  unsigned long g = (unsigned long)h & 0xffffffffUL, bit;
+  int i;
+
+  for (i = 0; i < GBT_FILTER_K; i++) {
+    bit = GBT_FILTER_BIT(GBT_FILTER_STEP(g));
+    b[bit >> 3] |= (unsigned char)(1U << (bit & 7));
+  }
+}
+
+static int gbt_FilterTest(const struct gbt_filter *const f, const size_t h) {
+  const unsigned char *const b =
+      f->bits + (h % f->nblocks) * GBT_FILTER_BLOCK;
+  unsigned long g = (unsigned long)h & 0xffffffffUL, bit;
+  int i;
+
+  for (i = 0; i < GBT_FILTER_K; i++) {
+    bit = GBT_FILTER_BIT(GBT_FILTER_STEP(g));
+    if (!(b[bit >> 3] & (1U << (bit & 7))))
+      return 0;
+  }
+  return 1;
+}
+
+static int gbt_FilterVisit(struct gbt_node *const item, void *const ctx) {
+  struct gbt_dict *const D = ctx;
+
+  gbt_FilterSet(&D->filter, D->key_hash(item->key));
+  return 0;
+}
+
+/* Size the filter for twice the live keys of D and fill it in. */
+static int gbt_FilterBuild(struct gbt_dict *const D) {
+  struct gbt_filter *const f = &D->filter;
+  const size_t keys = gbt_size(D);
+  size_t cap, n;
+
+  cap = keys < GBT_FILTER_MINKEYS / 2 ? GBT_FILTER_MINKEYS : 2 * keys;
+  n = cap <= GBT_SIZE_MAX / GBT_FILTER_BITS
+          ? ((cap * GBT_FILTER_BITS + GBT_FILTER_BLOCK * 8 - 1) /
+             (GBT_FILTER_BLOCK * 8)) |
+                1
+          : 0;
+  if (n != f->nblocks) {
+    free(f->bits);
+    f->bits = n ? malloc(n * GBT_FILTER_BLOCK) : NULL;
+    f->nblocks = f->bits ? n : 0;
+    if (!f->bits)
+      return 0;
+  }
+  memset(f->bits, 0, n * GBT_FILTER_BLOCK);
+  f->capacity = cap;
+  f->count = keys;
+  gbt_foreach(D, gbt_FilterVisit, D);
+  return 1;
+}
+
+/* Record a key just stored in D. */
+static void gbt_FilterAdd(struct gbt_dict *const D, const gbt_ky_type key) {
+  struct gbt_filter *const f = &D->filter;
+
+  if (!f->bits)
+    return;
+  if (f->count >= f->capacity) {
+    gbt_FilterBuild(D);
+    return;
+  }
+  f->count++;
+  gbt_FilterSet(f, D->key_hash(key));
+}
+
+/* Is key certainly not in D? */
+static int gbt_FilterMiss(struct gbt_dict *const D, const gbt_ky_type key) {
+  struct gbt_filter *const f = &D->filter;
+
+  if (!f->bits)
+    return 0;
+  f->queries++;
+  if (gbt_FilterTest(f, D->key_hash(key)))
+    return 0;
+  f->negatives++;
+  return 1;
+}
+
+/*-------------- lookup cache -------------------*/
+
+#define GBT_CACHE_SLOT(D, key) ((D)->key_hash(key) & ((D)->cache.size - 1))
+
+/* Forget node, which is about to be freed or hidden, if it is cached. */
+static void gbt_CacheDrop(struct gbt_dict *const D,
+                          const struct gbt_node *const node) {
+  struct gbt_node **slot;
+
+  if (!D->cache.size)
+    return;
+  slot = &D->cache.slots[GBT_CACHE_SLOT(D, node->key)];
+  if (*slot == node)
+    *slot = NULL;
+}
+
+static void gbt_CacheFlush(struct gbt_dict *const D) {
+  size_t i;
+
+  for (i = 0; i < D->cache.size; i++)
+    D->cache.slots[i] = NULL;
+}
+
+/*-------------- key hashing --------------------*/
+
+#define GBT_KEYHASH(h) ((unsigned int)((h) & 0x7fffffffUL))
+
+/* key_equal(key, t->key), with h the GBT_KEYHASH of key: when nodes */
+/* carry hashes, most mismatches are rejected without calling it.    */
+#define GBT_SAME(D, key, h, t)                                                 \
+  ((!(D)->use_keyhash || (t)->keyhash == (h)) &&                               \
+   (D)->key_equal(key, (t)->key))
+
+static unsigned int gbt_KeyHash(const struct gbt_dict *const D,
+                                const gbt_ky_type key) {
+  return D->use_keyhash ? GBT_KEYHASH(D->key_hash(key)) : 0;
+}
+
+static void gbt_HashTree(struct gbt_dict *const D, struct gbt_node *const t) {
+  if (!t)
+    return;
+  t->keyhash = GBT_KEYHASH(D->key_hash(t->key));
+  gbt_HashTree(D, t->left);
+  gbt_HashTree(D, t->right);
+}
+
 void leftrot(struct gbt_node **const t) {
   struct gbt_node *tmp;
 
@@ -77,10 +242,12 @@ void Split(struct gbt_node **t, const size_t p1, const size_t p2) {
   }
 }
 
-void gbt_PerfectBalance(struct gbt_node **const t, const size_t w) {
-  long b;
+/* Turn the list of w - 1 nodes hanging off */
+/* right links from *t into a perfectly     */
+/* balanced tree.                           */
+static void Compress(struct gbt_node **const t, const size_t w) {
+  size_t b;
 
-  Skew(t);
   b = 1;
   while (b <= w)
     b *= 2;
@@ -93,9 +260,250 @@ void gbt_PerfectBalance(struct gbt_node **const t, const size_t w) {
   }
 }
 
-long gbt_TreeWeight(struct gbt_node *t) {
+void gbt_PerfectBalance(struct gbt_node **const t, const size_t w) {
+  Skew(t);
+  Compress(t, w);
+}
+
+/*-------------- extremes -----------------------*/
+
+/* D->min and D->max are the leftmost and rightmost nodes, dead or not. */
+
+/* Clear the extremes that are about to be freed. */
+static void gbt_Forget(struct gbt_dict *const D,
+                       const struct gbt_node *const node) {
+  if (D->min == node)
+    D->min = NULL;
+  if (D->max == node)
+    D->max = NULL;
+}
+
+/* Find the extremes cleared by gbt_Forget again, by spine walks. */
+static void gbt_Ends(struct gbt_dict *const D) {
+  struct gbt_node *t;
+
+  if (!D->min && (t = D->t) != NULL) {
+    while (t->left)
+      t = t->left;
+    D->min = t;
+  }
+  if (!D->max && (t = D->t) != NULL) {
+    while (t->right)
+      t = t->right;
+    D->max = t;
+  }
+}
+
+/* The first (or, if right, last) live node in key order. */
+static struct gbt_node *gbt_LiveEnd(const struct gbt_dict *const D,
+                                    const int right) {
+  struct gbt_node *stack[GBT_MAXHEIGHT + 1], *t = D->t;
+  long top;
+
+  GBT_NULLSTACK;
+  for (;;) {
+    while (t) {
+      GBT_PUSH(t);
+      t = right ? t->right : t->left;
+    }
+    if (!top)
+      return NULL;
+    GBT_POP(t);
+    if (!t->dead)
+      return t;
+    t = right ? t->left : t->right;
+  }
+}
+
+/* Free a tombstone that has been unlinked. */
+static void gbt_Bury(struct gbt_dict *const D, struct gbt_node *const victim) {
+  gbt_Forget(D, victim);
+  if (D->key_destroy)
+    D->key_destroy(victim->key);
+  free(victim);
+  D->generation++;
+  D->numofdead--;
+  D->weight--;
+}
+
+/*----------------------------------------*/
+/* The flatten kernel: one in-order pass  */
+/* collects the w - 1 nodes under t into  */
+/* D->scratch (dropping tombstones), then */
+/* Link hangs them back top-down, writing */
+/* each node once. Returns the number of  */
+/* nodes kept in *kept, or 0 if the       */
+/* scratch buffer could not grow.         */
+/*----------------------------------------*/
+
+static int gbt_Flatten(struct gbt_dict *const D, struct gbt_node *t,
+                       const size_t w, size_t *const kept) {
+  struct gbt_node *stack[GBT_MAXHEIGHT + 1], *victim;
+  long top;
+  size_t n;
+
+  if (D->scratchsize < w - 1) {
+    struct gbt_node **scratch;
+    if (w - 1 > GBT_SIZE_MAX / sizeof(*scratch))
+      return 0;
+    scratch = realloc(D->scratch, (w - 1) * sizeof(*scratch));
+    if (!scratch)
+      return 0;
+    D->scratch = scratch;
+    D->scratchsize = w - 1;
+  }
+  n = 0;
+  GBT_NULLSTACK;
+  for (;;) {
+    while (t) {
+      GBT_PUSH(t);
+      t = t->left;
+    }
+    if (!top)
+      break;
+    GBT_POP(t);
+    if (!t->dead) {
+      D->scratch[n++] = t;
+      t = t->right;
+      continue;
+    }
+    victim = t;
+    t = t->right;
+    gbt_Bury(D, victim);
+  }
+  *kept = n;
+  return 1;
+}
+
+static struct gbt_node *Link(struct gbt_node **const a, const size_t n) {
+  const size_t mid = n / 2;
+
+  if (n == 0)
+    return NULL;
+  a[mid]->left = Link(a, mid);
+  a[mid]->right = Link(a + mid + 1, n - mid - 1);
+  return a[mid];
+}
+
+/*-------------- augmentation -------------------*/
+
+#ifdef GBT_AUGMENT
+#define GBT_OWN(D, t) ((t)->dead ? (D)->identity : (t)->data)
+#define GBT_AGG(D, t) ((t) ? (t)->agg : (D)->identity)
+
+/* Recompute the aggregate of t from its children's. */
+static void gbt_Pull(struct gbt_dict *const D, struct gbt_node *const t) {
+  t->agg = D->combine(D->combine(GBT_AGG(D, t->left), GBT_OWN(D, t)),
+                      GBT_AGG(D, t->right));
+}
+
+static void gbt_AggTree(struct gbt_dict *const D, struct gbt_node *const t) {
+  if (!t)
+    return;
+  gbt_AggTree(D, t->left);
+  gbt_AggTree(D, t->right);
+  gbt_Pull(D, t);
+}
+#endif /* GBT_AUGMENT */
+
+/* Recompute the aggregates of the nodes at path[d], ..., path[1]. */
+static void gbt_AggPath(struct gbt_dict *const D, struct gbt_node **path[],
+                        long d) {
+#ifdef GBT_AUGMENT
+  if (D->combine)
+    for (; d >= 1; d--)
+      gbt_Pull(D, *path[d]);
+#else
+  (void)D;
+  (void)path;
+  (void)d;
+#endif /* GBT_AUGMENT */
+}
+
+/* Recompute the aggregates from the node holding key up to the root. */
+static void gbt_AggKey(struct gbt_dict *const D, const gbt_ky_type key) {
+#ifdef GBT_AUGMENT
+  struct gbt_node *path[GBT_MAXHEIGHT + 1], *t = D->t;
+  unsigned int h;
+  long d = 0;
+
+  if (!D->combine)
+    return;
+  h = gbt_KeyHash(D, key);
+  while (t) {
+    path[d++] = t;
+    if (GBT_SAME(D, key, h, t))
+      break;
+    t = D->key_less(key, t->key) ? t->left : t->right;
+  }
+  while (d > 0)
+    gbt_Pull(D, path[--d]);
+#else
+  (void)D;
+  (void)key;
+#endif /* GBT_AUGMENT */
+}
+
+/* The skew kernel with tombstones: free them from the list, then */
+/* compress what is left.                                        */
+static void gbt_Purge(struct gbt_dict *const D, struct gbt_node **const t,
+                      size_t w) {
+  struct gbt_node **p, *victim;
+
+  Skew(t);
+  for (p = t; *p;) {
+    if (!(*p)->dead) {
+      p = &(*p)->right;
+      continue;
+    }
+    victim = *p;
+    *p = victim->right;
+    gbt_Bury(D, victim);
+    w--;
+  }
+  if (*t)
+    Compress(t, w);
+}
+
+/*----------------------------------------*/
+/* gbt_PerfectBalance for a subtree of D  */
+/* of weight w, with D's chosen kernel,   */
+/* which also drops the tombstones left   */
+/* by lazy deletion, and recomputes the   */
+/* aggregates of the subtree.             */
+/*----------------------------------------*/
+
+static void gbt_Rebuild(struct gbt_dict *const D, struct gbt_node **const t,
+                        const size_t w) {
+  size_t n;
+
+  if (!*t)
+    return;
+  if (D->rebuild_kernel == GBT_REBUILD_FLATTEN && gbt_Flatten(D, *t, w, &n))
+    *t = Link(D->scratch, n);
+  else if (!D->numofdead)
+    gbt_PerfectBalance(t, w);
+  else
+    gbt_Purge(D, t, w);
+  D->generation++; /* cursor paths through *t are stale */
+#ifdef GBT_AUGMENT
+  if (D->combine)
+    gbt_AggTree(D, *t);
+#endif /* GBT_AUGMENT */
+  gbt_Ends(D);
+}
+
+static void gbt_RebuildAll(struct gbt_dict *const D) {
+  gbt_Rebuild(D, &(D->t), D->weight);
+  D->numofdeletions = 0;
+  if (D->use_filter)
+    gbt_FilterBuild(D);
+}
+
+size_t gbt_TreeWeight(struct gbt_node *t) {
   struct gbt_node *stack[GBT_MAXHEIGHT];
-  long top, w;
+  long top;
+  size_t w;
 
   w = 1;
   GBT_NULLSTACK;
@@ -115,11 +523,44 @@ long gbt_TreeWeight(struct gbt_node *t) {
   return w;
 }
 
+/*----------------------------------------*/
+/* p[1..d1] is the path of links from the */
+/* root down to a node just inserted at   */
+/* depth d1. Rebuild the lowest subtree   */
+/* on the path that is too light for its  */
+/* height. Returns the depth of that      */
+/* subtree, or 0 if nothing was rebuilt.  */
+/*----------------------------------------*/
+
+static long gbt_FixPath(struct gbt_dict *const D, struct gbt_node **const p[],
+                        const long d1) {
+  long d2;
+  size_t w;
+
+  if (d1 <= 1)
+    return 0;
+
+  d2 = d1;
+  w = 2; /* b */
+  do {
+    d2--;
+    if (d2 < 1)
+      break;
+    if (&(*p[d2])->left == p[d2 + 1])
+      w = w + gbt_TreeWeight((*p[d2])->right);
+    else
+      w = w + gbt_TreeWeight((*p[d2])->left);
+  } while (w >= gbt_minweight[d1 - d2 + 1]);
+  if (d2 < 1)
+    return 0;
+  gbt_Rebuild(D, p[d2], w); /* c */
+  return d2;
+}
+
 void gbt_FixBalance(struct gbt_dict *const D, const gbt_ky_type key,
                     const long d1) {
   long d2;
   struct gbt_node **p[GBT_MAXHEIGHT + 1];
-  long w;
 
   if (d1 <= 1)
     return;
@@ -131,26 +572,25 @@ void gbt_FixBalance(struct gbt_dict *const D, const gbt_ky_type key,
     else
       p[d2 + 1] = &(*p[d2])->right;
   }
-  w = 2; /* b */
-  do {
-    d2--;
-    if (d2 < 1)
-      break;
-    if (&(*p[d2])->left == p[d2 + 1])
-      w = w + gbt_TreeWeight((*p[d2])->right);
-    else
-      w = w + gbt_TreeWeight((*p[d2])->left);
-  } while (w >= gbt_minweight[d1 - d2 + 1]);
-  if (d2 >= 1)
-    gbt_PerfectBalance(p[d2], w); /* c */
+  gbt_FixPath(D, p, d1);
 }
 
+/*----------------------------------------*/
+/* gbt_minweight[h] is the least weight   */
+/* of a tree allowed to have height h.    */
+/* Heights whose weight cannot fit in a   */
+/* size_t are capped at GBT_SIZE_MAX, so  */
+/* they are never reached.                */
+/*----------------------------------------*/
+
 void gbt_InitGlobal(void) {
   long h;
+  double w;
 
-  for (h = 1; h <= GBT_MAXHEIGHT; h++)
-    gbt_minweight[h] =
-        (long)(exp((double)(h - 1) / GBT_C * log(2.0)) + 0.5) + 1;
+  for (h = 1; h <= GBT_MAXHEIGHT; h++) {
+    w = floor(exp((double)(h - 1) / GBT_C * log(2.0)) + 0.5) + 1;
+    gbt_minweight[h] = w >= (double)GBT_SIZE_MAX ? GBT_SIZE_MAX : (size_t)w;
+  }
 }
 
 struct gbt_dict *gbt_construct_dict(void) {
@@ -159,22 +599,21 @@ struct gbt_dict *gbt_construct_dict(void) {
       gbt_default_assign, gbt_default_key_destroy, gbt_default_key_print);
 }
 
-struct gbt_dict *
-gbt_construct_dict_full(const gbt_ky_assign_func key_assign_func,
-                        const gbt_ky_less_func key_less_than_func,
-                        const gbt_ky_equal_func key_equal_func,
-                        const gbt_assign_func assign_func,
-                        const gbt_key_destroy_func key_destroy_func,
-                        const gbt_key_print_func key_print_func) {
-  struct gbt_dict *p;
-
+void gbt_InitDict(struct gbt_dict *const p,
+                  const gbt_ky_assign_func key_assign_func,
+                  const gbt_ky_less_func key_less_than_func,
+                  const gbt_ky_equal_func key_equal_func,
+                  const gbt_assign_func assign_func,
+                  const gbt_key_destroy_func key_destroy_func,
+                  const gbt_key_print_func key_print_func) {
   gbt_InitGlobal();
-  p = calloc(1, sizeof(*p));
-  if (!p)
-    return NULL;
+  memset(p, 0, sizeof(*p));
   p->t = NULL;
   p->weight = 1;
   p->numofdeletions = 0;
+  p->rebuild_kernel = GBT_REBUILD_KERNEL;
+  p->key_hash = gbt_default_key_hash;
+  gbt_cursor_init(p, &p->hint);
 
   /* Store function pointers */
   p->key_assign =
@@ -188,18 +627,42 @@ gbt_construct_dict_full(const gbt_ky_assign_func key_assign_func,
       key_destroy_func == NULL ? gbt_default_key_destroy : key_destroy_func;
   p->key_print =
       key_print_func == NULL ? gbt_default_key_print : key_print_func;
+}
+
+struct gbt_dict *
+gbt_construct_dict_full(const gbt_ky_assign_func key_assign_func,
+                        const gbt_ky_less_func key_less_than_func,
+                        const gbt_ky_equal_func key_equal_func,
+                        const gbt_assign_func assign_func,
+                        const gbt_key_destroy_func key_destroy_func,
+                        const gbt_key_print_func key_print_func) {
+  struct gbt_dict *p;
 
+  p = malloc(sizeof(*p));
+  if (!p)
+    return NULL;
+  gbt_InitDict(p, key_assign_func, key_less_than_func, key_equal_func,
+               assign_func, key_destroy_func, key_print_func);
   return p;
 }
 
-void gbt_CreateNode(struct gbt_dict *const D, const gbt_ky_type key,
-                    const gbt_data_type val, struct gbt_node **const t) {
+static struct gbt_node *gbt_NewNode(struct gbt_dict *const D,
+                                     const gbt_ky_type key,
+                                     struct gbt_node **const t) {
   *t = calloc(1, sizeof(**t));
   if (!*t)
-    return;
+    return NULL;
 
   D->key_assign(&(*t)->key, key);
-  D->assign(&(*t)->data, val);
+  if (D->use_keyhash)
+    (*t)->keyhash = GBT_KEYHASH(D->key_hash((*t)->key));
+  return *t;
+}
+
+void gbt_CreateNode(struct gbt_dict *const D, const gbt_ky_type key,
+                    const gbt_data_type val, struct gbt_node **const t) {
+  if (gbt_NewNode(D, key, t))
+    D->assign(&(*t)->data, val);
 }
 
 void gbt_Display(struct gbt_dict *D, struct gbt_node *t, const long depth) {
@@ -220,40 +683,352 @@ void gbt_Display(struct gbt_dict *D, struct gbt_node *t, const long depth) {
   gbt_Display(D, t->right, depth + 1);
 }
 
-struct gbt_node *gbt_insert(struct gbt_dict *D, gbt_ky_type key,
-                            gbt_data_type in) {
-  long d1;
-  struct gbt_node **candidate, **p, *newnode;
+/*----------------------------------------*/
+/* Descend from the link path[from] (at   */
+/* depth from) to a leaf, recording every */
+/* link passed in path. Returns the node  */
+/* holding key with *depth its depth, or  */
+/* NULL with *depth the depth of the      */
+/* empty link where key belongs.          */
+/*----------------------------------------*/
 
-  d1 = 1;
-  p = &(D->t);
-  candidate = NULL;
+static struct gbt_node *gbt_Descend(struct gbt_dict *const D,
+                                    const gbt_ky_type key,
+                                    struct gbt_node **path[], const long from,
+                                    long *const depth) {
+  const unsigned int h = gbt_KeyHash(D, key);
+  long d1, found;
+  struct gbt_node **p;
+
+  d1 = from;
+  p = path[from];
+  found = 0;
   while (*p) {
     if (D->key_less(key, (*p)->key)) {
       p = &(*p)->left;
     } else {
-      if (D->key_equal(key, (*p)->key))
-        candidate = p;
+      if (GBT_SAME(D, key, h, *p))
+        found = d1;
       p = &(*p)->right;
     }
-    d1++;
+    path[++d1] = p;
   }
-  if (candidate)
-    return *candidate;
-  gbt_CreateNode(D, key, in, p);
-  newnode = *p;
+  *depth = found ? found : d1;
+  return found ? *path[found] : NULL;
+}
+
+/* Walk down from path[from] to node again after a rebuild below it. */
+static long gbt_Retrace(struct gbt_dict *const D, struct gbt_node **path[],
+                        long from, const struct gbt_node *const node) {
+  while (*path[from] != node) {
+    if (D->key_less(node->key, (*path[from])->key))
+      path[from + 1] = &(*path[from])->left;
+    else
+      path[from + 1] = &(*path[from])->right;
+    from++;
+  }
+  return from;
+}
+
+/* Bring back a tombstone found on insertion. */
+static void gbt_Revive(struct gbt_dict *const D, struct gbt_node *const node) {
+  node->dead = 0;
+  D->numofdead--;
+  gbt_FilterAdd(D, node->key);
+}
+
+/* Account for the node just linked in at path[d1]. Returns its depth. */
+static long gbt_Grow(struct gbt_dict *const D, struct gbt_node **path[],
+                     const long d1) {
+  const struct gbt_node *const node = *path[d1];
+  long d2;
+
   D->weight++;
-  if (D->weight < (size_t)(gbt_minweight[d1]))
-    gbt_FixBalance(D, key, d1);
+  gbt_FilterAdd(D, node->key);
+  if (!D->min || D->min->left == node) /* went left all the way */
+    D->min = *path[d1];
+  if (!D->max || D->max->right == node)
+    D->max = *path[d1];
+  d2 = D->weight >= (size_t)(gbt_minweight[d1]) ? 0 : gbt_FixPath(D, path, d1);
+  if (!d2) {
+    gbt_AggPath(D, path, d1);
+    return d1;
+  }
+  gbt_AggPath(D, path, d2 - 1); /* the rebuild did the subtree */
+  return gbt_Retrace(D, path, d2, node);
+}
+
+struct gbt_node *gbt_insert_ex(struct gbt_dict *D, const gbt_ky_type key,
+                               const gbt_data_type in, int *const created) {
+  long d1;
+  struct gbt_node **path[GBT_MAXHEIGHT + 1], *newnode;
+
+  path[1] = &(D->t);
+  newnode = gbt_Descend(D, key, path, 1, &d1);
+  if (created)
+    *created = 0;
+  if (newnode) {
+    if (newnode->dead) {
+      gbt_Revive(D, newnode);
+      D->assign(&newnode->data, in);
+      gbt_AggPath(D, path, d1);
+      if (created)
+        *created = 1;
+    }
+    return newnode;
+  }
+  gbt_CreateNode(D, key, in, path[d1]);
+  newnode = *path[d1];
+  if (!newnode)
+    return NULL;
+  gbt_Grow(D, path, d1);
+  if (created)
+    *created = 1;
+  return newnode;
+}
+
+struct gbt_node *gbt_insert(struct gbt_dict *D, gbt_ky_type key,
+                            gbt_data_type in) {
+  return gbt_insert_ex(D, key, in, NULL);
+}
+
+struct gbt_node *gbt_upsert_ex(struct gbt_dict *D, const gbt_ky_type key,
+                               const gbt_data_type in, int *const created) {
+  long d1;
+  struct gbt_node **path[GBT_MAXHEIGHT + 1], *node;
+
+  path[1] = &(D->t);
+  node = gbt_Descend(D, key, path, 1, &d1);
+  if (created)
+    *created = 0;
+  if (node) {
+    if (node->dead) {
+      gbt_Revive(D, node);
+      if (created)
+        *created = 1;
+    }
+    D->assign(&node->data, in);
+    gbt_AggPath(D, path, d1);
+    return node;
+  }
+  gbt_CreateNode(D, key, in, path[d1]);
+  node = *path[d1];
+  if (!node)
+    return NULL;
+  gbt_Grow(D, path, d1);
+  if (created)
+    *created = 1;
+  return node;
+}
+
+struct gbt_node *gbt_upsert(struct gbt_dict *D, const gbt_ky_type key,
+                            const gbt_data_type in) {
+  return gbt_upsert_ex(D, key, in, NULL);
+}
+
+struct gbt_node *gbt_get_or_insert(struct gbt_dict *D, const gbt_ky_type key,
+                                   const gbt_data_ctor_func ctor,
+                                   void *const ctx) {
+  long d1;
+  struct gbt_node **path[GBT_MAXHEIGHT + 1], *node;
+
+  path[1] = &(D->t);
+  node = gbt_Descend(D, key, path, 1, &d1);
+  if (node) {
+    if (node->dead) {
+      gbt_Revive(D, node);
+      if (ctor)
+        ctor(&node->data, key, ctx);
+      gbt_AggPath(D, path, d1);
+    }
+    return node;
+  }
+  node = gbt_NewNode(D, key, path[d1]);
+  if (!node)
+    return NULL;
+  if (ctor)
+    ctor(&node->data, key, ctx);
+  gbt_Grow(D, path, d1);
+  return node;
+}
+
+/*-------------- cursors -------------------------*/
+
+void gbt_cursor_init(struct gbt_dict *const D, struct gbt_cursor *const c) {
+  c->D = D;
+  c->depth = 0;
+  c->generation = D->generation;
+}
+
+#ifdef GBT_DEBUG
+/* Is every link on the path of c a child link of the node above it? */
+static int gbt_CursorLinked(const struct gbt_cursor *const c) {
+  long j;
+
+  if (c->path[1] != &(c->D->t))
+    return 0;
+  for (j = 1; j < c->depth; j++)
+    if (!*c->path[j] || (c->path[j + 1] != &(*c->path[j])->left &&
+                         c->path[j + 1] != &(*c->path[j])->right))
+      return 0;
+  return 1;
+}
+#endif /* GBT_DEBUG */
+
+/*----------------------------------------*/
+/* Does c still describe the current      */
+/* root-to-node path? Inserting a leaf    */
+/* leaves every other path alone; all     */
+/* else that moves or frees nodes bumps   */
+/* the generation. So this costs O(1).    */
+/*----------------------------------------*/
+
+static int gbt_CursorValid(const struct gbt_cursor *const c) {
+  if (c->depth < 1 || c->generation != c->D->generation ||
+      !*c->path[c->depth])
+    return 0;
+#ifdef GBT_DEBUG
+  assert(gbt_CursorLinked(c));
+#endif /* GBT_DEBUG */
+  return 1;
+}
+
+/*----------------------------------------*/
+/* Deepest level on the cursor path whose */
+/* subtree must contain key: walk up from */
+/* the cursor node until key lies         */
+/* strictly between the nearest ancestor  */
+/* on each side. Near-sorted keys stop    */
+/* after a comparison or two.             */
+/*----------------------------------------*/
+
+static long gbt_CursorStart(const struct gbt_cursor *const c,
+                            const gbt_ky_type key) {
+  struct gbt_dict *const D = c->D;
+  long j, k;
+  int lo_ok = 0, hi_ok = 0;
+
+  k = c->depth;
+  for (j = c->depth - 1; j >= 1 && !(lo_ok && hi_ok); j--) {
+    if (c->path[j + 1] == &(*c->path[j])->right) {
+      if (lo_ok)
+        continue;
+      if (D->key_less((*c->path[j])->key, key))
+        lo_ok = 1;
+      else
+        k = j;
+    } else {
+      if (hi_ok)
+        continue;
+      if (D->key_less(key, (*c->path[j])->key))
+        hi_ok = 1;
+      else
+        k = j;
+    }
+  }
+  return k;
+}
+
+static struct gbt_node *gbt_CursorPlace(struct gbt_cursor *const c,
+                                        const gbt_ky_type key,
+                                        const gbt_data_type in,
+                                        const long from) {
+  struct gbt_dict *const D = c->D;
+  struct gbt_node *node;
+  long d1;
+
+  node = gbt_Descend(D, key, c->path, from, &d1);
+  if (node && node->dead) {
+    gbt_Revive(D, node);
+    D->assign(&node->data, in);
+    gbt_AggPath(D, c->path, d1);
+  } else if (!node) {
+    gbt_CreateNode(D, key, in, c->path[d1]);
+    node = *c->path[d1];
+    if (!node) {
+      c->depth = 0;
+      return NULL;
+    }
+    d1 = gbt_Grow(D, c->path, d1);
+  }
+  c->depth = d1;
+  c->generation = D->generation;
+  return node;
+}
+
+struct gbt_node *gbt_cursor_insert(struct gbt_cursor *const c,
+                                   const gbt_ky_type key,
+                                   const gbt_data_type in) {
+  if (!gbt_CursorValid(c)) {
+    c->path[1] = &(c->D->t);
+    return gbt_CursorPlace(c, key, in, 1);
+  }
+  return gbt_CursorPlace(c, key, in, gbt_CursorStart(c, key));
+}
+
+struct gbt_node *gbt_insert_next(struct gbt_dict *const D,
+                                 const gbt_ky_type key,
+                                 const gbt_data_type in) {
+  return gbt_cursor_insert(&(D->hint), key, in);
+}
+
+struct gbt_node *gbt_append(struct gbt_dict *const D, const gbt_ky_type key,
+                            const gbt_data_type in) {
+  struct gbt_cursor *const c = &(D->hint);
+  struct gbt_node *max, *newnode;
+  long j;
+
+  if (!D->t)
+    return gbt_insert_next(D, key, in);
+  /* the path to the maximum is the right spine */
+  if (!gbt_CursorValid(c) || *c->path[c->depth] != D->max) {
+    /* reposition at the maximum: no comparisons */
+    c->path[1] = &(D->t);
+    for (j = 1; (*c->path[j])->right; j++)
+      c->path[j + 1] = &(*c->path[j])->right;
+    c->depth = j;
+    c->generation = D->generation;
+  }
+  max = *c->path[c->depth];
+  if (!D->key_less(max->key, key))
+    return gbt_cursor_insert(c, key, in);
+
+  c->path[c->depth + 1] = &max->right;
+  gbt_CreateNode(D, key, in, &max->right);
+  newnode = max->right;
+  if (!newnode)
+    return NULL;
+  c->depth = gbt_Grow(D, c->path, c->depth + 1);
+  c->generation = D->generation;
   return newnode;
 }
 
 struct gbt_node *gbt_lookup(struct gbt_dict *D, const gbt_ky_type key) {
-  struct gbt_node *t = D->t;
+  struct gbt_node *t = D->t, **slot = NULL;
+  size_t hash = 0;
+  unsigned int h;
+
+  if (D->cache.size || D->use_keyhash)
+    hash = D->key_hash(key);
+  h = GBT_KEYHASH(hash);
+  if (D->cache.size) {
+    slot = &D->cache.slots[hash & (D->cache.size - 1)];
+    if (*slot && GBT_SAME(D, key, h, *slot)) {
+      D->cache.hits++;
+      return *slot;
+    }
+    D->cache.misses++;
+  }
+  if (gbt_FilterMiss(D, key))
+    return NULL;
   while (t) {
-    if (D->key_equal(key, t->key))
+    if (GBT_SAME(D, key, h, t)) {
+      if (t->dead)
+        return NULL;
+      if (slot)
+        *slot = t;
       return t;
-    else if (D->key_less(key, t->key))
+    } else if (D->key_less(key, t->key))
       t = t->left;
     else
       t = t->right;
@@ -261,21 +1036,71 @@ struct gbt_node *gbt_lookup(struct gbt_dict *D, const gbt_ky_type key) {
   return NULL;
 }
 
-void gbt_delete(struct gbt_dict *D, const gbt_ky_type key) {
+/*----------------------------------------*/
+/* After a deletion: a global rebuild     */
+/* once the deletions since the last one  */
+/* reach GBT_MAXDEL times the weight, or  */
+/* tombstones outnumber live items.       */
+/*----------------------------------------*/
+
+static void gbt_CheckDeletions(struct gbt_dict *const D) {
+  if ((D->numofdead && D->numofdead * 2 > D->weight - 1) ||
+      (D->numofdeletions > GBT_MAXDEL * D->weight && D->weight > 3))
+    gbt_RebuildAll(D);
+}
+
+int gbt_delete_get(struct gbt_dict *D, const gbt_ky_type key,
+                   gbt_data_type *const out) {
   struct gbt_node **candidate, **last = NULL, *tmp, **t;
+  struct gbt_node **path[GBT_MAXHEIGHT + 1];
+  long d = 0, dc = 0;
+  int found = 0;
+
+  if (D->lazy_delete) { /* leave a tombstone */
+    const unsigned int h = gbt_KeyHash(D, key);
+
+    /* not gbt_lookup: a delete is no cache hit or miss */
+    tmp = gbt_FilterMiss(D, key) ? NULL : D->t;
+    while (tmp && !GBT_SAME(D, key, h, tmp))
+      tmp = D->key_less(key, tmp->key) ? tmp->left : tmp->right;
+    if (tmp && !tmp->dead) {
+      found = 1;
+      if (out) {
+        *out = tmp->data; /* ownership passes to the caller */
+        memset(&tmp->data, 0, sizeof(tmp->data));
+      }
+      gbt_CacheDrop(D, tmp);
+      tmp->dead = 1;
+      D->numofdead++;
+      D->numofdeletions++;
+      gbt_AggKey(D, key);
+    }
+    gbt_CheckDeletions(D);
+    return found;
+  }
 
+  if (gbt_FilterMiss(D, key))
+    return 0;
   t = &(D->t);
   candidate = NULL;
   while (*t) {
     last = t;
+    path[++d] = t;
     if (D->key_less(key, (*t)->key))
       t = &(*t)->left;
     else {
       candidate = t;
+      dc = d;
       t = &(*t)->right;
     }
   }
   if (candidate && (D->key_equal((*candidate)->key, key))) {
+    found = 1;
+    D->generation++;
+    gbt_CacheDrop(D, *candidate);
+    gbt_Forget(D, *candidate);
+    if (out)
+      *out = (*candidate)->data; /* ownership passes to the caller */
     D->numofdeletions++;
     D->weight--;
     tmp = *last;
@@ -293,12 +1118,239 @@ void gbt_delete(struct gbt_dict *D, const gbt_ky_type key) {
         D->key_destroy((*candidate)->key);
       free(*candidate);
       *candidate = tmp;
+      path[dc + 1] = &tmp->right; /* was the freed node's */
     }
+    gbt_AggPath(D, path, d - 1);
+    gbt_Ends(D);
+  }
+  gbt_CheckDeletions(D);
+  return found;
+}
+
+void gbt_delete(struct gbt_dict *D, const gbt_ky_type key) {
+  gbt_delete_get(D, key, NULL);
+}
+
+/*-------------- min / max ----------------------*/
+
+struct gbt_node *gbt_min(struct gbt_dict *const D) {
+  return D->min && D->min->dead ? gbt_LiveEnd(D, 0) : D->min;
+}
+
+struct gbt_node *gbt_max(struct gbt_dict *const D) {
+  return D->max && D->max->dead ? gbt_LiveEnd(D, 1) : D->max;
+}
+
+#define GBT_OUTER(t, right) ((right) ? &(t)->right : &(t)->left)
+
+/*----------------------------------------*/
+/* Unlink the leftmost (rightmost if      */
+/* right) node, burying tombstones met on */
+/* the way, until a live node comes off.  */
+/* The outer child of the node unlinked   */
+/* is empty, so its inner child takes its */
+/* place. One walk down the spine finds   */
+/* the node, and the next extreme is the  */
+/* end of the inner child's spine or the  */
+/* parent.                                */
+/*----------------------------------------*/
+
+static int gbt_PopEnd(struct gbt_dict *const D, const int right,
+                      gbt_ky_type *const key, gbt_data_type *const out) {
+  struct gbt_node **path[GBT_MAXHEIGHT + 1], *node, *end;
+  long d = 1;
+
+  path[1] = &(D->t);
+  for (;;) {
+    if (!*path[d])
+      return 0;
+    while (*GBT_OUTER(*path[d], right)) {
+      path[d + 1] = GBT_OUTER(*path[d], right);
+      d++;
+    }
+    node = *path[d];
+    *path[d] = right ? node->left : node->right;
+    if (!node->dead)
+      break;
+    gbt_Bury(D, node);
+    if (!*path[d] && d > 1)
+      d--;
+  }
+
+  D->generation++;
+  D->numofdeletions++;
+  D->weight--;
+  gbt_CacheDrop(D, node);
+  gbt_Forget(D, node);
+  for (end = *path[d]; end && *GBT_OUTER(end, right);)
+    end = *GBT_OUTER(end, right);
+  if (!end && d > 1)
+    end = *path[d - 1];
+  if (right)
+    D->max = end;
+  else
+    D->min = end;
+  gbt_Ends(D);
+  gbt_AggPath(D, path, d - 1);
+
+  if (key)
+    *key = node->key; /* ownership passes to the caller */
+  else if (D->key_destroy)
+    D->key_destroy(node->key);
+  if (out)
+    *out = node->data;
+  free(node);
+  gbt_CheckDeletions(D);
+  return 1;
+}
+
+int gbt_pop_min(struct gbt_dict *const D, gbt_ky_type *const key,
+                gbt_data_type *const out) {
+  return gbt_PopEnd(D, 0, key, out);
+}
+
+int gbt_pop_max(struct gbt_dict *const D, gbt_ky_type *const key,
+                gbt_data_type *const out) {
+  return gbt_PopEnd(D, 1, key, out);
+}
+
+void gbt_set_rebuild_kernel(struct gbt_dict *const D, const int kernel) {
+  D->rebuild_kernel = kernel;
+}
+
+void gbt_balance(struct gbt_dict *const D) { gbt_RebuildAll(D); }
+
+int gbt_set_filter(struct gbt_dict *const D, const int on) {
+  D->use_filter = on;
+  if (on)
+    return gbt_FilterBuild(D);
+  free(D->filter.bits);
+  D->filter.bits = NULL;
+  D->filter.nblocks = 0;
+  return 1;
+}
+
+void gbt_set_key_hash(struct gbt_dict *const D, const gbt_key_hash_func hash) {
+  D->key_hash = hash == NULL ? gbt_default_key_hash : hash;
+  gbt_CacheFlush(D);
+  if (D->use_filter)
+    gbt_FilterBuild(D);
+  if (D->use_keyhash)
+    gbt_HashTree(D, D->t);
+}
+
+void gbt_set_key_hashing(struct gbt_dict *const D, const int on) {
+  if (on && !D->use_keyhash)
+    gbt_HashTree(D, D->t);
+  D->use_keyhash = on != 0;
+}
+
+/* The false-positive rate is the chance that GBT_FILTER_K random bits */
+/* of a random block are all set, averaged over the blocks.            */
+void gbt_filter_stats(struct gbt_dict *const D,
+                      struct gbt_filter_stats *const s) {
+  const struct gbt_filter *const f = &D->filter;
+  size_t i, j;
+  unsigned int set, c;
+
+  s->bytes = f->nblocks * GBT_FILTER_BLOCK;
+  s->keys = f->bits ? f->count : 0;
+  s->fp_rate = f->bits ? 0.0 : 1.0;
+  s->queries = f->queries;
+  s->negatives = f->negatives;
+  for (i = 0; i < f->nblocks; i++) {
+    set = 0;
+    for (j = 0; j < GBT_FILTER_BLOCK; j++)
+      for (c = f->bits[i * GBT_FILTER_BLOCK + j]; c; c &= c - 1)
+        set++;
+    s->fp_rate += pow((double)set / (GBT_FILTER_BLOCK * 8), GBT_FILTER_K) /
+                  (double)f->nblocks;
   }
-  if (D->numofdeletions > GBT_MAXDEL * D->weight && D->weight > 3) {
-    gbt_PerfectBalance(&(D->t), D->weight);
-    D->numofdeletions = 0;
+}
+
+int gbt_set_cache(struct gbt_dict *const D, const size_t slots) {
+  struct gbt_node **p = NULL;
+  size_t n = 0;
+
+  if (slots) {
+    for (n = 1; n < slots; n <<= 1)
+      if (n > GBT_SIZE_MAX / sizeof(*p) / 2)
+        return 0;
+    p = malloc(n * sizeof(*p));
+    if (!p)
+      return 0;
   }
+  free(D->cache.slots);
+  D->cache.slots = p;
+  D->cache.size = n;
+  D->cache.hits = D->cache.misses = 0;
+  gbt_CacheFlush(D);
+  return 1;
+}
+
+void gbt_cache_stats(struct gbt_dict *const D,
+                     struct gbt_cache_stats *const s) {
+  s->slots = D->cache.size;
+  s->hits = D->cache.hits;
+  s->misses = D->cache.misses;
+}
+
+#ifdef GBT_AUGMENT
+void gbt_set_augment(struct gbt_dict *const D, const gbt_combine_func combine,
+                     const gbt_data_type identity) {
+  D->combine = combine;
+  D->identity = identity;
+  if (combine)
+    gbt_AggTree(D, D->t);
+}
+
+/*----------------------------------------*/
+/* Below the node where the searches for  */
+/* lo and hi part, the path to lo adds    */
+/* each node at or above lo with its      */
+/* right subtree, and the path to hi each */
+/* node below hi with its left subtree.   */
+/*----------------------------------------*/
+
+gbt_data_type gbt_aggregate_range(struct gbt_dict *const D,
+                                  const gbt_ky_type lo, const gbt_ky_type hi) {
+  struct gbt_node *t = D->t, *s;
+  gbt_data_type left, right;
+
+  if (!D->combine)
+    return D->identity;
+  while (t) {
+    if (D->key_less(t->key, lo))
+      t = t->right;
+    else if (!D->key_less(t->key, hi))
+      t = t->left;
+    else
+      break;
+  }
+  if (!t)
+    return D->identity;
+  left = right = D->identity;
+  for (s = t->left; s;)
+    if (D->key_less(s->key, lo))
+      s = s->right;
+    else {
+      left = D->combine(D->combine(GBT_OWN(D, s), GBT_AGG(D, s->right)), left);
+      s = s->left;
+    }
+  for (s = t->right; s;)
+    if (D->key_less(s->key, hi)) {
+      right = D->combine(right, D->combine(GBT_AGG(D, s->left), GBT_OWN(D, s)));
+      s = s->right;
+    } else
+      s = s->left;
+  return D->combine(D->combine(left, GBT_OWN(D, t)), right);
+}
+#endif /* GBT_AUGMENT */
+
+void gbt_set_lazy_delete(struct gbt_dict *const D, const int on) {
+  D->lazy_delete = on;
+  if (!on && D->numofdead)
+    gbt_RebuildAll(D);
 }
 
 gbt_ky_type gbt_keyval(struct gbt_dict *const _, struct gbt_node *const item) {
@@ -310,7 +1362,52 @@ gbt_data_type *gbt_infoval(struct gbt_dict *const _,
   return &(item)->data;
 } /*gbt_infoval*/
 
-size_t gbt_size(struct gbt_dict *const D) { return D->weight - 1; } /*gbt_size*/
+size_t gbt_size(struct gbt_dict *const D) {
+  return D->weight - 1 - D->numofdead;
+} /*gbt_size*/
+
+/*----------------------------------------*/
+/* In-order walk of t, skipping subtrees  */
+/* wholly below lo (if has_lo) or at or   */
+/* above hi (if has_hi).                  */
+/*----------------------------------------*/
+
+static int gbt_Visit(struct gbt_dict *const D, struct gbt_node *t,
+                     const gbt_ky_type *lo, const gbt_ky_type *const hi,
+                     const gbt_visit_func visit, void *const ctx) {
+  int rc;
+
+  while (t) {
+    if (lo && D->key_less(t->key, *lo)) {
+      t = t->right;
+      continue;
+    }
+    if (hi && !D->key_less(t->key, *hi)) {
+      t = t->left;
+      continue;
+    }
+    rc = gbt_Visit(D, t->left, lo, NULL, visit, ctx); /* all below hi */
+    if (rc)
+      return rc;
+    rc = t->dead ? 0 : visit(t, ctx);
+    if (rc)
+      return rc;
+    lo = NULL; /* all of t->right is above lo */
+    t = t->right;
+  }
+  return 0;
+}
+
+int gbt_foreach(struct gbt_dict *const D, const gbt_visit_func visit,
+                void *const ctx) {
+  return gbt_Visit(D, D->t, NULL, NULL, visit, ctx);
+} /*gbt_foreach*/
+
+int gbt_foreach_range(struct gbt_dict *const D, const gbt_ky_type lo,
+                      const gbt_ky_type hi, const gbt_visit_func visit,
+                      void *const ctx) {
+  return gbt_Visit(D, D->t, &lo, &hi, visit, ctx);
+} /*gbt_foreach_range*/
 
 void gbt_ClearTree(struct gbt_dict *const D, struct gbt_node **const t) {
   if (!*t)
@@ -327,11 +1424,26 @@ void gbt_ClearTree(struct gbt_dict *const D, struct gbt_node **const t) {
 
 void gbt_clear(struct gbt_dict *const D) {
   gbt_ClearTree(D, &(D->t));
+  D->generation++;
   D->weight = 1;
   D->numofdeletions = 0;
+  D->numofdead = 0;
+  D->min = D->max = NULL;
+  gbt_CacheFlush(D);
+  if (D->filter.bits) {
+    memset(D->filter.bits, 0, D->filter.nblocks * GBT_FILTER_BLOCK);
+    D->filter.count = 0;
+  }
 } /*clear*/
 
-void gbt_destruct_dict(struct gbt_dict *D) {
+void gbt_FreeDict(struct gbt_dict *const D) {
   gbt_clear(D);
+  free(D->scratch);
+  free(D->filter.bits);
+  free(D->cache.slots);
+}
+
+void gbt_destruct_dict(struct gbt_dict *D) {
+  gbt_FreeDict(D);
   free(D);
 } /*destruct_dict */
@@ -8,9 +8,13 @@ extern "C" {
 #include <general_balanced_tree_c_export.h>
 
 #ifndef GBT_C
-#define GBT_C 1.35 /* Other values could be used.         */
-                   /* as long as GBT_C > 1.               */
-#endif             /* !GBT_C */
+#ifndef GBT_C_NUM
+#define GBT_C_NUM 27 /* GBT_C = GBT_C_NUM / GBT_C_DEN = 1.35 */
+#define GBT_C_DEN 20 /* Other values could be used         */
+                     /* as long as GBT_C > 1.              */
+#endif               /* !GBT_C_NUM */
+#define GBT_C ((double)GBT_C_NUM / GBT_C_DEN)
+#endif /* !GBT_C */
 #ifndef GBT_MAXDEL
 #define GBT_MAXDEL 10 /* The number of deletions          */
                       /* since last global rebalancing    */
@@ -18,10 +22,41 @@ extern "C" {
                       /* tree weight.                     */
                       /* (Other constant possible.)       */
 #endif                /* !GBT_MAXDEL */
+#ifndef GBT_ADDRESS_BITS
+#if defined(_WIN64) || defined(__LP64__) || defined(_LP64) ||                  \
+    defined(__x86_64__) || defined(__aarch64__) ||                             \
+    (defined(__SIZEOF_POINTER__) && __SIZEOF_POINTER__ == 8)
+#define GBT_ADDRESS_BITS 64
+#else
+#define GBT_ADDRESS_BITS 32
+#endif
+#endif /* !GBT_ADDRESS_BITS */
 #ifndef GBT_MAXHEIGHT
-#define GBT_MAXHEIGHT 40 /* We assume GBT_C * log n < 40. */
-                         /* Keep an eye on this one!      */
-#endif                   /* !GBT_MAXHEIGHT */
+#ifdef GBT_C_NUM
+/* A tree of height h weighs at least 2^((h - 1) / GBT_C), and no more */
+/* than 2^GBT_ADDRESS_BITS nodes fit in memory, so heights stay below  */
+/* GBT_C * GBT_ADDRESS_BITS + 1. One more covers the node being added. */
+#define GBT_MAXHEIGHT                                                          \
+  ((GBT_C_NUM * GBT_ADDRESS_BITS + GBT_C_DEN - 1) / GBT_C_DEN + 2)
+#else
+#define GBT_MAXHEIGHT (2 * GBT_ADDRESS_BITS + 2) /* Enough for GBT_C <= 2. */
+#endif /* GBT_C_NUM */
+#endif /* !GBT_MAXHEIGHT */
+#define GBT_SIZE_MAX ((size_t)-1)
+#define GBT_REBUILD_SKEW 0    /* Skew to a list, then Split passes. */
+#define GBT_REBUILD_FLATTEN 1 /* Collect into an array, relink.     */
+#ifndef GBT_REBUILD_KERNEL
+#define GBT_REBUILD_KERNEL GBT_REBUILD_FLATTEN
+#endif /* !GBT_REBUILD_KERNEL */
+#ifndef GBT_FILTER_BITS
+#define GBT_FILTER_BITS 10 /* Membership filter bits per key */
+#endif                     /* when fullest (about 1% false   */
+                           /* positives).                    */
+#ifndef GBT_FILTER_K
+#define GBT_FILTER_K 7 /* Bits set per key. */
+#endif                 /* !GBT_FILTER_K     */
+#define GBT_FILTER_BLOCK 64 /* Bytes per filter block: a cache line. */
+/* #define GBT_AUGMENT to keep subtree aggregates in nodes. */
 #ifndef GBT_SCREENWIDTH
 #define GBT_SCREENWIDTH 40 /* For displaying tree.        */
 #endif                     /* !GBT_SCREENWIDTH            */
@@ -44,6 +79,11 @@ typedef int (*gbt_ky_equal_func)(gbt_ky_type, gbt_ky_type);
 typedef void (*gbt_assign_func)(gbt_data_type *, gbt_data_type);
 typedef void (*gbt_key_destroy_func)(gbt_ky_type);
 typedef void (*gbt_key_print_func)(gbt_ky_type);
+typedef void (*gbt_data_ctor_func)(gbt_data_type *, gbt_ky_type, void *);
+typedef size_t (*gbt_key_hash_func)(gbt_ky_type);
+typedef gbt_data_type (*gbt_combine_func)(gbt_data_type, gbt_data_type);
+struct gbt_node;
+typedef int (*gbt_visit_func)(struct gbt_node *, void *);
 
 /*----- Procedures for external use -----------------
 
@@ -56,12 +96,138 @@ struct gbt_node * (struct gbt_dict * D, gbt_ky_type key,
                 data_type in)
    Insert key and data, returns a reference.
 
+struct gbt_node * gbt_insert_ex (struct gbt_dict * D, gbt_ky_type key,
+                data_type in, int * created)
+   As gbt_insert; *created (if non-NULL) tells whether a node was made.
+
+struct gbt_node * gbt_upsert (struct gbt_dict * D, gbt_ky_type key,
+                data_type in)
+   Insert key and data, or overwrite the data of an existing key.
+
+struct gbt_node * gbt_upsert_ex (struct gbt_dict * D, gbt_ky_type key,
+                data_type in, int * created)
+   As gbt_upsert; *created (if non-NULL) tells whether the key was new.
+
+struct gbt_node * gbt_get_or_insert (struct gbt_dict * D, gbt_ky_type key,
+                gbt_data_ctor_func ctor, void * ctx)
+   Returns the existing reference, or inserts key and lets
+   ctor(&data, key, ctx) fill in the data of the new node.
+
+struct gbt_node * gbt_insert_next (struct gbt_dict * D,
+                gbt_ky_type key, data_type in)
+   As gbt_insert, continuing the search from where the previous
+   gbt_insert_next or gbt_append ended (see gbt_cursor_insert). Nodes
+   keep no parent links, so a search can resume from a recorded path
+   but not from a bare node reference.
+
+struct gbt_node * gbt_append (struct gbt_dict * D, gbt_ky_type key,
+                data_type in)
+   As gbt_insert, with a fast path for key above every stored key.
+
+void gbt_cursor_init (struct gbt_dict * D, struct gbt_cursor * c)
+struct gbt_node * gbt_cursor_insert (struct gbt_cursor * c,
+                gbt_ky_type key, data_type in)
+   As gbt_insert, starting the search from where the previous insert
+   through c ended. For near-sorted keys this costs O(1) amortised
+   comparisons.
+
 struct gbt_node * gbt_lookup (struct gbt_dict * D, gbt_ky_type key)
    Returns a reference.
 
 void gbt_delete (struct gbt_dict * D, gbt_ky_type key)
    Delete key (and data)
 
+int gbt_delete_get (struct gbt_dict * D, gbt_ky_type key,
+                data_type * out)
+   Delete key; hands the removed data back through out (if non-NULL).
+   Returns 1 if key was present, else 0.
+
+struct gbt_node * gbt_min (struct gbt_dict * D)
+struct gbt_node * gbt_max (struct gbt_dict * D)
+   Reference to the item with the smallest (largest) key, or NULL if
+   D is empty. O(1), unless tombstones sit at that end of the tree.
+
+int gbt_pop_min (struct gbt_dict * D, gbt_ky_type * key,
+                data_type * out)
+int gbt_pop_max (struct gbt_dict * D, gbt_ky_type * key,
+                data_type * out)
+   Delete the item with the smallest (largest) key in one walk down
+   the spine, handing its key and data back through key and out (if
+   non-NULL; the key is destroyed otherwise). Returns 1, or 0 if D is
+   empty. Tombstones met on the way are freed.
+
+Each of the insert/delete procedures does a single root-to-leaf descent
+(a lazy deletion with aggregates on takes a second one).
+
+void gbt_balance (struct gbt_dict * D)
+   Rebuild the whole tree into perfect balance.
+
+void gbt_set_rebuild_kernel (struct gbt_dict * D, int kernel)
+   How D rebuilds subtrees: GBT_REBUILD_SKEW rotates the subtree into a
+   list and splits it with more rotations; GBT_REBUILD_FLATTEN (the
+   default, see GBT_REBUILD_KERNEL) collects the nodes into a scratch
+   array kept on D and links them up again top-down. The flatten kernel
+   falls back to the rotations if the scratch array cannot grow.
+
+void gbt_set_lazy_delete (struct gbt_dict * D, int on)
+   With lazy deletion on, deleting a key just marks its node dead. The
+   tombstone is skipped by lookups and walks, reused if the key is
+   inserted again, and freed by the next partial or global rebuild
+   that covers it. A global rebuild is forced once tombstones
+   outnumber live items. Turning lazy deletion off purges them all.
+
+int gbt_set_filter (struct gbt_dict * D, int on)
+   With the filter on, D keeps a blocked Bloom filter of its keys, so
+   that gbt_lookup and gbt_delete of most absent keys return without
+   touching the tree. Inserts add to it; it is rebuilt for the live
+   keys, at twice their number, by every global rebuild and whenever
+   it fills up. Returns 0 if there was no memory for it, in which case
+   lookups search the tree until a later rebuild succeeds.
+
+void gbt_set_key_hash (struct gbt_dict * D, gbt_key_hash_func hash)
+   Hash used by the filter, the cache and key hashing (NULL for
+   gbt_default_key_hash). Equal keys must hash equally.
+
+void gbt_set_key_hashing (struct gbt_dict * D, int on)
+   With key hashing on, each node keeps 31 bits of its key's hash, set
+   when the node is made, and searches hash the key once and call
+   key_equal only on nodes whose hash matches. Worth it when key_equal
+   is costly (long or composite keys): a lookup of a present key then
+   typically compares keys in full once, or not at all on a cache
+   miss in a colliding slot. Turning it on hashes the stored keys.
+
+void gbt_filter_stats (struct gbt_dict * D, struct gbt_filter_stats * s)
+   Filter size in bytes, keys added since it was built, estimated
+   false-positive rate, and how many queries it answered negatively.
+
+int gbt_set_cache (struct gbt_dict * D, size_t slots)
+   Put a direct-mapped cache of references, with slots rounded up to a
+   power of two (0 removes it), in front of gbt_lookup: a key found in
+   the tree is remembered in the slot its hash picks, so that looking
+   it up again costs one key_equal call. Rebuilds keep nodes, hence
+   the cache; deletion and clearing drop what they free. Returns 0 if
+   there was no memory for it. The counters start again from 0.
+
+void gbt_cache_stats (struct gbt_dict * D, struct gbt_cache_stats * s)
+   Cache slots, and lookups answered from the cache or not.
+
+void gbt_set_augment (struct gbt_dict * D, gbt_combine_func combine,
+                gbt_data_type identity)
+   Keep in each node the combination of the data in its subtree, so
+   that range aggregates cost O(log n). combine must be associative
+   (it need not commute) and identity its neutral element, e.g. sum
+   with 0 or max with LONG_MIN. NULL turns the aggregates off. Data
+   must then be changed through the dictionary (gbt_upsert), not
+   through gbt_infoval. Only built with GBT_AUGMENT defined (for the
+   library and its users alike), which adds a gbt_data_type to every
+   node of every dictionary, aggregating or not: with an int key and
+   long data, 40 bytes instead of 32 on 64-bit builds.
+
+gbt_data_type gbt_aggregate_range (struct gbt_dict * D, gbt_ky_type lo,
+                gbt_ky_type hi)
+   Combination, in key order, of the data of the items with
+   lo <= key < hi; identity if there are none.
+
 ky_type gbt_keyval (struct gbt_dict * D, struct gbt_node * item)
    Get key via reference.
 
@@ -71,6 +237,13 @@ data_type *gbt_infoval (struct gbt_dict * D, struct gbt_node * item)
 size_t gbt_size (struct gbt_dict * D)
    Number of stored items (= tree weight - 1)
 
+int gbt_foreach (struct gbt_dict * D, gbt_visit_func visit, void * ctx)
+int gbt_foreach_range (struct gbt_dict * D, gbt_ky_type lo,
+                gbt_ky_type hi, gbt_visit_func visit, void * ctx)
+   Call visit(item, ctx) for every item (with lo <= key < hi) in
+   key order. A non-zero return from visit stops the walk and is
+   passed back; otherwise 0 is returned.
+
 void clear (struct gbt_dict * D)
    Remove everything from dictionary.
 
@@ -85,12 +258,73 @@ the external user as reference to stored items.
 
 struct gbt_node {
   gbt_ky_type key;
+  unsigned int dead : 1;     /* tombstone left by lazy deletion */
+  unsigned int keyhash : 31; /* see gbt_set_key_hashing */
   gbt_data_type data;
+#ifdef GBT_AUGMENT
+  gbt_data_type agg; /* data of the subtree, see gbt_set_augment */
+#endif /* GBT_AUGMENT */
   struct gbt_node *left, *right;
 };
+struct gbt_dict;
+
+/* Remembers the root-to-node path of the last insert through it, so
+   that the next insert of a nearby key can start from there. */
+struct gbt_cursor {
+  struct gbt_dict *D;
+  struct gbt_node **path[GBT_MAXHEIGHT + 1]; /* path[1] == &D->t */
+  long depth;                                /* 0: not positioned */
+  unsigned long generation;
+};
+
+/* Blocked Bloom filter over the keys of a dictionary. */
+struct gbt_filter {
+  unsigned char *bits; /* nblocks blocks of GBT_FILTER_BLOCK bytes */
+  size_t nblocks;
+  size_t capacity; /* keys it takes before being rebuilt larger */
+  size_t count;    /* keys added since it was built */
+  unsigned long queries, negatives;
+};
+
+struct gbt_filter_stats {
+  size_t bytes;
+  size_t keys;
+  double fp_rate; /* estimated from the bits set */
+  unsigned long queries, negatives;
+};
+
+/* Direct-mapped cache of lookup results. */
+struct gbt_cache {
+  struct gbt_node **slots;
+  size_t size; /* a power of two, or 0 */
+  unsigned long hits, misses;
+};
+
+struct gbt_cache_stats {
+  size_t slots;
+  unsigned long hits, misses;
+};
+
 struct gbt_dict {
   struct gbt_node *t;
+  struct gbt_node *min, *max; /* leftmost and rightmost nodes */
   size_t weight, numofdeletions;
+  size_t numofdead; /* tombstones, counted in weight */
+  int lazy_delete;
+  int rebuild_kernel;        /* GBT_REBUILD_SKEW or GBT_REBUILD_FLATTEN */
+  struct gbt_node **scratch; /* reused by the flatten kernel */
+  size_t scratchsize;
+  unsigned long generation; /* bumped whenever nodes move or are freed */
+  struct gbt_cursor hint;   /* used by gbt_insert_next and gbt_append */
+  int use_filter;
+  struct gbt_filter filter;
+  struct gbt_cache cache;
+  gbt_key_hash_func key_hash;
+  int use_keyhash; /* nodes carry keyhash */
+#ifdef GBT_AUGMENT
+  gbt_combine_func combine; /* NULL: no aggregates */
+  gbt_data_type identity;
+#endif /* GBT_AUGMENT */
 
   gbt_ky_assign_func key_assign;
   gbt_ky_less_func key_less;
@@ -100,7 +334,7 @@ struct gbt_dict {
   gbt_key_print_func key_print;
 };
 
-static long gbt_minweight[GBT_MAXHEIGHT + 1];
+extern size_t gbt_minweight[GBT_MAXHEIGHT + 1]; /* set by gbt_InitGlobal */
 
 /*---------------------------*/
 /* The tree is shown on the  */
@@ -130,6 +364,8 @@ extern GENERAL_BALANCED_TREE_C_EXPORT void gbt_default_key_destroy(gbt_ky_type);
 
 extern GENERAL_BALANCED_TREE_C_EXPORT void gbt_default_key_print(gbt_ky_type);
 
+extern GENERAL_BALANCED_TREE_C_EXPORT size_t gbt_default_key_hash(gbt_ky_type);
+
 /*-------------- construction -------------------*/
 
 extern GENERAL_BALANCED_TREE_C_EXPORT void gbt_InitGlobal(void);
@@ -161,28 +397,116 @@ gbt_PerfectBalance(struct gbt_node **, size_t);
     t = stack[top];                                                            \
     top--;                                                                     \
   }
-extern long gbt_TreeWeight(struct gbt_node *);
+extern size_t gbt_TreeWeight(struct gbt_node *);
 
 extern void gbt_FixBalance(struct gbt_dict *, gbt_ky_type, long);
 
 extern void gbt_CreateNode(struct gbt_dict *, gbt_ky_type, gbt_data_type,
                            struct gbt_node **);
 
+/* gbt_construct_dict_full and gbt_destruct_dict for a dict the caller */
+/* allocates itself (as gbt_sharded.c does, inside a padded slot).     */
+extern void gbt_InitDict(struct gbt_dict *, gbt_ky_assign_func,
+                         gbt_ky_less_func, gbt_ky_equal_func, gbt_assign_func,
+                         gbt_key_destroy_func, gbt_key_print_func);
+
+extern void gbt_FreeDict(struct gbt_dict *);
+
 extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_node *
 gbt_insert(struct gbt_dict *, gbt_ky_type, gbt_data_type);
 
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_node *
+gbt_insert_ex(struct gbt_dict *, gbt_ky_type, gbt_data_type, int *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_node *
+gbt_upsert(struct gbt_dict *, gbt_ky_type, gbt_data_type);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_node *
+gbt_upsert_ex(struct gbt_dict *, gbt_ky_type, gbt_data_type, int *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_node *
+gbt_get_or_insert(struct gbt_dict *, gbt_ky_type, gbt_data_ctor_func, void *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_cursor_init(struct gbt_dict *, struct gbt_cursor *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_node *
+gbt_cursor_insert(struct gbt_cursor *, gbt_ky_type, gbt_data_type);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_node *
+gbt_insert_next(struct gbt_dict *, gbt_ky_type, gbt_data_type);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_node *
+gbt_append(struct gbt_dict *, gbt_ky_type, gbt_data_type);
+
 extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_node *
 gbt_lookup(struct gbt_dict *, gbt_ky_type);
 
 extern GENERAL_BALANCED_TREE_C_EXPORT void gbt_delete(struct gbt_dict *,
                                                       gbt_ky_type);
 
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_delete_get(struct gbt_dict *, gbt_ky_type, gbt_data_type *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_node *
+gbt_min(struct gbt_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT struct gbt_node *
+gbt_max(struct gbt_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_pop_min(struct gbt_dict *, gbt_ky_type *, gbt_data_type *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_pop_max(struct gbt_dict *, gbt_ky_type *, gbt_data_type *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void gbt_set_lazy_delete(struct gbt_dict *,
+                                                               int);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_set_rebuild_kernel(struct gbt_dict *, int);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void gbt_balance(struct gbt_dict *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int gbt_set_filter(struct gbt_dict *,
+                                                         int);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_set_key_hash(struct gbt_dict *, gbt_key_hash_func);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_set_key_hashing(struct gbt_dict *, int);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_filter_stats(struct gbt_dict *, struct gbt_filter_stats *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int gbt_set_cache(struct gbt_dict *,
+                                                        size_t);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_cache_stats(struct gbt_dict *, struct gbt_cache_stats *);
+
+#ifdef GBT_AUGMENT
+extern GENERAL_BALANCED_TREE_C_EXPORT void
+gbt_set_augment(struct gbt_dict *, gbt_combine_func, gbt_data_type);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT gbt_data_type
+gbt_aggregate_range(struct gbt_dict *, gbt_ky_type, gbt_ky_type);
+#endif /* GBT_AUGMENT */
+
 extern gbt_ky_type gbt_keyval(struct gbt_dict *, struct gbt_node *);
 
 extern gbt_data_type *gbt_infoval(struct gbt_dict *, struct gbt_node *);
 
 extern GENERAL_BALANCED_TREE_C_EXPORT size_t gbt_size(struct gbt_dict *);
 
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_foreach(struct gbt_dict *, gbt_visit_func, void *);
+
+extern GENERAL_BALANCED_TREE_C_EXPORT int
+gbt_foreach_range(struct gbt_dict *, gbt_ky_type, gbt_ky_type, gbt_visit_func,
+                  void *);
+
 extern GENERAL_BALANCED_TREE_C_EXPORT void gbt_ClearTree(struct gbt_dict *,
                                                          struct gbt_node **);
 
@@ -53,21 +53,20 @@ int Go() {
       scanf("%d%*[^\n]", &x);
 #endif
       getchar();
-      temp = gbt_lookup(thedict, x);
-      if (temp) {
-        if (temp->key == x) {
+      {
+        int created;
+        temp = gbt_insert_ex(thedict, x, 0, &created);
+        if (temp == NULL) {
+          printf("Out of memory, %d was not inserted.\n", x);
+          break;
+        }
+        if (!created) {
           printf("No insertion, %d is already present.\n", x);
           break;
         }
-      }
-      {
-        temp = gbt_insert(thedict, x, 0);
         gbt_Display(thedict, thedict->t, 0L);
         if (temp->key != x)
           printf("something is wrong.\n");
-        temp = gbt_lookup(thedict, x);
-        if (temp->key != x)
-          printf("something is wrong.\n");
       }
       break;
 
@@ -85,13 +84,9 @@ int Go() {
       scanf("%d%*[^\n]", &x);
 #endif
       getchar();
-      temp = gbt_lookup(thedict, x);
-      if (!temp) {
-        printf("Sorry, could not find %d\n", x);
-      } else if (temp->key != x) {
+      if (!gbt_delete_get(thedict, x, NULL)) {
         printf("Sorry, could not find %d\n", x);
       } else {
-        gbt_delete(thedict, x);
         gbt_Display(thedict, thedict->t, 0L);
       }
       break;
@@ -108,7 +103,7 @@ int Go() {
       scanf("%*[^\n]");
 #endif
       getchar();
-      gbt_PerfectBalance(&thedict->t, thedict->weight);
+      gbt_balance(thedict);
       gbt_Display(thedict, thedict->t, 0L);
       break;
 
@@ -0,0 +1,466 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#define _POSIX_C_SOURCE 199309L /* clock_gettime */
+#include <time.h>
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <general_balanced_tree_c.h>
+
+/*---------------------------------------------*/
+/* Replays a recorded operation trace against  */
+/* a dictionary, without display, and reports  */
+/* throughput and latency per operation type.  */
+/*                                             */
+/* Text traces hold one operation per line, as */
+/* for the interactive program:                */
+/*   i x   insert x (with data x)              */
+/*   d x   delete x                            */
+/*   l x   look up x                           */
+/*   c     clear                               */
+/*   b     balance                             */
+/* Blank lines and lines starting with # are   */
+/* skipped. Other lines over 255 characters,   */
+/* keys outside 32 bits (or the key type) and  */
+/* junk after an operation are errors.         */
+/*                                             */
+/* Binary traces start with "GBTR", followed   */
+/* by 5-byte records: the operation letter,    */
+/* then x as a 32-bit little-endian two's      */
+/* complement integer.                         */
+/*---------------------------------------------*/
+
+#define MAGIC "GBTR"
+#define BUCKETS 40 /* latency buckets: < 2^k ns */
+
+static const char ops[] = "idlcb";
+static const char *const op_names[] = {"insert", "delete", "lookup", "clear",
+                                       "balance"};
+#define NOPS 5
+
+struct op {
+  char code;
+  gbt_ky_type key;
+};
+
+struct trace {
+  struct op *ops;
+  size_t n, size;
+};
+
+struct stats {
+  unsigned long count;
+  double total; /* ns */
+  unsigned long hist[BUCKETS];
+};
+
+static void Usage(const char *const name) {
+  fprintf(stderr,
+          "usage: %s [-v] [-o out] trace\n"
+          " -v      check the final tree against the trace\n"
+          " -o out  also write the trace to out in binary form\n"
+          " trace   text or binary trace, - for stdin\n",
+          name);
+}
+
+/*-------------- timing -------------------------*/
+
+static double Now(void) { /* ns */
+#ifdef _WIN32
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER t;
+
+  if (!freq.QuadPart)
+    QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&t);
+  return (double)t.QuadPart * 1e9 / (double)freq.QuadPart;
+#else
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+#endif
+}
+
+static void Record(struct stats *const s, const double ns) {
+  int b = 0;
+  double limit = 1.0;
+
+  while (b < BUCKETS - 1 && ns >= limit) {
+    b++;
+    limit *= 2.0;
+  }
+  s->count++;
+  s->total += ns;
+  s->hist[b]++;
+}
+
+/* Upper bound of the bucket holding the q-quantile. */
+static double Quantile(const struct stats *const s, const double q) {
+  unsigned long seen = 0;
+  double limit = 1.0;
+  int b;
+
+  for (b = 0; b < BUCKETS; b++, limit *= 2.0) {
+    seen += s->hist[b];
+    if ((double)seen >= q * (double)s->count)
+      break;
+  }
+  return limit;
+}
+
+/*-------------- reading traces -----------------*/
+
+static int Push(struct trace *const T, const char code, const gbt_ky_type key) {
+  if (!strchr(ops, code) || !code)
+    return 0;
+  if (T->n == T->size) {
+    const size_t size = T->size ? 2 * T->size : 1024;
+    struct op *const p = realloc(T->ops, size * sizeof(*p));
+    if (!p)
+      return 0;
+    T->ops = p;
+    T->size = size;
+  }
+  T->ops[T->n].code = code;
+  T->ops[T->n].key = key;
+  T->n++;
+  return 1;
+}
+
+static int ReadBinary(FILE *const f, struct trace *const T) {
+  unsigned char r[5];
+  unsigned long u;
+  size_t got;
+
+  while ((got = fread(r, 1, sizeof(r), f)) == sizeof(r)) {
+    u = (unsigned long)r[1] | (unsigned long)r[2] << 8 |
+        (unsigned long)r[3] << 16 | (unsigned long)r[4] << 24;
+    if (!Push(T, (char)r[0],
+              (gbt_ky_type)(u & 0x80000000UL ? -(long)(~u & 0x7fffffffUL) - 1
+                                             : (long)u)))
+      return 0;
+  }
+  return got == 0;
+}
+
+/* A file, with the bytes read while looking for the magic put back. */
+struct source {
+  FILE *f;
+  char head[sizeof(MAGIC)];
+  size_t headlen, headpos;
+};
+
+static int Getc(struct source *const src) {
+  if (src->headpos < src->headlen)
+    return (unsigned char)src->head[src->headpos++];
+  return getc(src->f);
+}
+
+static int ReadText(struct source *const src, struct trace *const T) {
+  char line[256], *p, *end;
+  long x;
+  unsigned long lineno = 0;
+  size_t len;
+  int c = 0, truncated;
+
+  while (c != EOF) {
+    len = 0;
+    truncated = 0;
+    while ((c = Getc(src)) != EOF && c != '\n') {
+      if (len < sizeof(line) - 1)
+        line[len++] = (char)c;
+      else
+        truncated = 1;
+    }
+    line[len] = '\0';
+    lineno++;
+    for (p = line; *p == ' ' || *p == '\t'; p++)
+      ;
+    if (*p == '#')
+      continue;
+    if (truncated) {
+      fprintf(stderr, "line %lu: longer than %lu characters\n", lineno,
+              (unsigned long)(sizeof(line) - 1));
+      return 0;
+    }
+    if (!*p || *p == '\r')
+      continue;
+    x = 0;
+    end = p + 1;
+    if (strchr("idl", *p)) {
+      errno = 0;
+      x = strtol(p + 1, &end, 10);
+      if (end == p + 1)
+        end = p; /* no key */
+      else if (errno == ERANGE || x < -2147483647L - 1 || x > 2147483647L ||
+               (long)(gbt_ky_type)x != x) {
+        fprintf(stderr, "line %lu: key out of range in \"%s\"\n", lineno,
+                line);
+        return 0;
+      }
+    }
+    while (*end == ' ' || *end == '\t' || *end == '\r')
+      end++;
+    if (*end || !Push(T, *p, (gbt_ky_type)x)) {
+      fprintf(stderr, "line %lu: cannot read \"%s\"\n", lineno, line);
+      return 0;
+    }
+  }
+  return !ferror(src->f);
+}
+
+static int ReadTrace(const char *const name, struct trace *const T) {
+  struct source src;
+  int ok;
+
+  src.f = strcmp(name, "-") ? fopen(name, "rb") : stdin;
+  if (!src.f) {
+    perror(name);
+    return 0;
+  }
+  src.headlen = fread(src.head, 1, sizeof(MAGIC) - 1, src.f);
+  src.headpos = 0;
+  if (src.headlen == sizeof(MAGIC) - 1 && !memcmp(src.head, MAGIC, src.headlen))
+    ok = ReadBinary(src.f, T);
+  else
+    ok = ReadText(&src, T);
+  if (src.f != stdin)
+    fclose(src.f);
+  return ok;
+}
+
+static int WriteBinary(const char *const name, const struct trace *const T) {
+  FILE *const f = fopen(name, "wb");
+  unsigned char r[5];
+  unsigned long u;
+  size_t i;
+  int ok;
+
+  if (!f) {
+    perror(name);
+    return 0;
+  }
+  ok = fwrite(MAGIC, 1, sizeof(MAGIC) - 1, f) == sizeof(MAGIC) - 1;
+  for (i = 0; ok && i < T->n; i++) {
+    u = (unsigned long)(long)T->ops[i].key & 0xffffffffUL;
+    r[0] = (unsigned char)T->ops[i].code;
+    r[1] = (unsigned char)(u & 0xff);
+    r[2] = (unsigned char)(u >> 8 & 0xff);
+    r[3] = (unsigned char)(u >> 16 & 0xff);
+    r[4] = (unsigned char)(u >> 24 & 0xff);
+    ok = fwrite(r, 1, sizeof(r), f) == sizeof(r);
+  }
+  return fclose(f) == 0 && ok;
+}
+
+/*-------------- replay -------------------------*/
+
+static void Replay(struct gbt_dict *const D, const struct trace *const T,
+                   struct stats st[NOPS]) {
+  const struct op *o;
+  double t0, t1;
+  size_t i;
+
+  for (i = 0; i < T->n; i++) {
+    o = &T->ops[i];
+    t0 = Now();
+    switch (o->code) {
+    case 'i':
+      gbt_insert(D, o->key, (gbt_data_type)o->key);
+      break;
+    case 'd':
+      gbt_delete(D, o->key);
+      break;
+    case 'l':
+      gbt_lookup(D, o->key);
+      break;
+    case 'c':
+      gbt_clear(D);
+      break;
+    default:
+      gbt_balance(D);
+      break;
+    }
+    t1 = Now();
+    Record(&st[strchr(ops, o->code) - ops], t1 - t0);
+  }
+}
+
+static void Report(const struct stats st[NOPS], const double wall) {
+  int k, b, last;
+  double limit;
+
+  printf("%-8s %10s %12s %9s %9s %9s\n", "op", "count", "ops/s", "mean ns",
+         "p50 ns", "p99 ns");
+  for (k = 0; k < NOPS; k++)
+    if (st[k].count)
+      printf("%-8s %10lu %12.0f %9.1f %9.0f %9.0f\n", op_names[k],
+             st[k].count, (double)st[k].count * 1e9 / st[k].total,
+             st[k].total / (double)st[k].count, Quantile(&st[k], 0.5),
+             Quantile(&st[k], 0.99));
+  printf("wall %.3f s\n", wall / 1e9);
+
+  puts("latency histogram (ops taking < ns)");
+  for (k = 0; k < NOPS; k++) {
+    if (!st[k].count)
+      continue;
+    for (last = BUCKETS - 1; last > 0 && !st[k].hist[last]; last--)
+      ;
+    printf("  %s\n", op_names[k]);
+    for (b = 0, limit = 1.0; b <= last; b++, limit *= 2.0)
+      if (st[k].hist[b])
+        printf("    %12.0f %10lu\n", limit, st[k].hist[b]);
+  }
+}
+
+/*-------------- verification -------------------*/
+
+/*---------------------------------------------*/
+/* The reference is the trace after its last   */
+/* clear, sorted by key and then by position:  */
+/* the last insert or delete of each key       */
+/* decides whether the key is present. An      */
+/* in-order walk of the tree must meet exactly */
+/* the present keys, each with data equal to   */
+/* its key.                                    */
+/*---------------------------------------------*/
+
+struct ref {
+  gbt_ky_type key;
+  size_t pos;
+  char code;
+};
+
+static int CompareRef(const void *const a, const void *const b) {
+  const struct ref *const x = a, *const y = b;
+
+  if (x->key != y->key)
+    return x->key < y->key ? -1 : 1;
+  return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+struct walk {
+  const struct ref *ref;
+  size_t n, next; /* position in ref of the next present key */
+  const struct gbt_node *bad;
+};
+
+/* Step w->next to the next key whose last operation is an insert. */
+static void NextPresent(struct walk *const w) {
+  size_t i = w->next;
+
+  while (i < w->n) {
+    while (i + 1 < w->n && w->ref[i + 1].key == w->ref[i].key)
+      i++;
+    if (w->ref[i].code == 'i')
+      break;
+    i++;
+  }
+  w->next = i;
+}
+
+static int VerifyVisit(struct gbt_node *const item, void *const ctx) {
+  struct walk *const w = ctx;
+
+  if (w->next >= w->n || item->key != w->ref[w->next].key ||
+      item->data != (gbt_data_type)item->key) {
+    w->bad = item;
+    return 1;
+  }
+  w->next++;
+  NextPresent(w);
+  return 0;
+}
+
+static int Verify(struct gbt_dict *const D, const struct trace *const T) {
+  struct ref *ref;
+  struct walk w;
+  size_t i, start = 0, n = 0;
+
+  for (i = 0; i < T->n; i++)
+    if (T->ops[i].code == 'c')
+      start = i + 1;
+  ref = malloc((T->n - start + 1) * sizeof(*ref));
+  if (!ref) {
+    fputs("verify: out of memory\n", stderr);
+    return 0;
+  }
+  for (i = start; i < T->n; i++)
+    if (T->ops[i].code == 'i' || T->ops[i].code == 'd') {
+      ref[n].key = T->ops[i].key;
+      ref[n].pos = i;
+      ref[n].code = T->ops[i].code;
+      n++;
+    }
+  qsort(ref, n, sizeof(*ref), CompareRef);
+
+  w.ref = ref;
+  w.n = n;
+  w.next = 0;
+  w.bad = NULL;
+  NextPresent(&w);
+  gbt_foreach(D, VerifyVisit, &w);
+  if (w.bad)
+    printf("verify: FAILED at key %" KEY_TYPE_FMT ", expected %s\n",
+           w.bad->key, w.next < n ? "a smaller key" : "no more keys");
+  else if (w.next < n)
+    printf("verify: FAILED, key %" KEY_TYPE_FMT " is missing\n",
+           ref[w.next].key);
+  else
+    printf("verify: ok, %lu keys\n", (unsigned long)gbt_size(D));
+  free(ref);
+  return !w.bad && w.next >= n;
+}
+
+int main(int argc, char *argv[]) {
+  struct trace T = {NULL, 0, 0};
+  struct stats st[NOPS];
+  struct gbt_dict *D;
+  const char *out = NULL, *name = NULL;
+  double start;
+  int i, verify = 0, rc = EXIT_SUCCESS;
+
+  for (i = 1; i < argc; i++)
+    if (!strcmp(argv[i], "-v"))
+      verify = 1;
+    else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+      out = argv[++i];
+    else if (!name)
+      name = argv[i];
+    else
+      break;
+  if (!name || i < argc) {
+    Usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (!ReadTrace(name, &T)) {
+    fprintf(stderr, "%s: not a valid trace\n", name);
+    free(T.ops);
+    return EXIT_FAILURE;
+  }
+  if (out && !WriteBinary(out, &T)) {
+    free(T.ops);
+    return EXIT_FAILURE;
+  }
+
+  D = gbt_construct_dict();
+  if (!D) {
+    free(T.ops);
+    return EXIT_FAILURE;
+  }
+  memset(st, 0, sizeof(st));
+  start = Now();
+  Replay(D, &T, st);
+  Report(st, Now() - start);
+  if (verify && !Verify(D, &T))
+    rc = EXIT_FAILURE;
+
+  gbt_destruct_dict(D);
+  free(T.ops);
+  return rc;
+}
@@ -1,5 +1,12 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L /* shm_open, for test_gbt_shm.h */
+#endif /* !_WIN32 && !_POSIX_C_SOURCE */
+
 #include <greatest.h>
 
+#include "test_gbt_compact.h"
+#include "test_gbt_sharded.h"
+#include "test_gbt_shm.h"
 #include "test_general_balanced_tree_c.h"
 
 /* Add definitions that need to be in the test runner's main file. */
@@ -8,5 +15,8 @@ GREATEST_MAIN_DEFS();
 int main(int argc, char **argv) {
   GREATEST_MAIN_BEGIN();
   RUN_SUITE(general_balanced_tree_c_suite);
+  RUN_SUITE(gbt_compact_suite);
+  RUN_SUITE(gbt_sharded_suite);
+  RUN_SUITE(gbt_shm_suite);
   GREATEST_MAIN_END();
 }
@@ -0,0 +1,138 @@
+#ifndef TEST_GBT_COMPACT_H
+#define TEST_GBT_COMPACT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <gbt_compact.h>
+#include <greatest.h>
+
+/* Checks in-order keys are strictly increasing; returns the node count */
+static size_t compact_check_order(const struct gbt_compact_dict *const dict,
+                                  const gbt_handle t, gbt_handle *const prev,
+                                  int *const ok) {
+  size_t n;
+  if (!t)
+    return 0;
+  n = compact_check_order(dict, dict->nodes[t].left, prev, ok);
+  if (*prev && !(gbt_compact_keyval((struct gbt_compact_dict *)dict, *prev) <
+                 gbt_compact_keyval((struct gbt_compact_dict *)dict, t)))
+    *ok = 0;
+  *prev = t;
+  return n + 1 + compact_check_order(dict, dict->nodes[t].right, prev, ok);
+}
+
+static int compact_is_valid(const struct gbt_compact_dict *const dict) {
+  gbt_handle prev = GBT_NIL;
+  int ok = 1;
+  return compact_check_order(dict, dict->t, &prev, &ok) == dict->weight - 1 &&
+         ok;
+}
+
+/* Test insertion, lookup, duplicates and size */
+TEST compact_tree_insert_lookup(void) {
+  struct gbt_compact_dict *const dict = gbt_compact_construct_dict();
+  ASSERT(dict != NULL);
+  ASSERT_EQ(gbt_compact_size(dict), 0);
+
+  {
+    const gbt_handle h = gbt_compact_insert(dict, 42, 100);
+    ASSERT(h != GBT_NIL);
+    ASSERT_EQ(gbt_compact_keyval(dict, h), 42);
+    ASSERT(*gbt_compact_infoval(dict, h) == 100);
+    ASSERT_EQ(gbt_compact_insert(dict, 42, 200), h); /* same node */
+    ASSERT(*gbt_compact_infoval(dict, h) == 100);    /* data unchanged */
+    ASSERT_EQ(gbt_compact_lookup(dict, 42), h);
+    ASSERT_EQ(gbt_compact_lookup(dict, 43), GBT_NIL);
+    ASSERT_EQ(gbt_compact_size(dict), 1);
+  }
+
+  gbt_compact_destruct_dict(dict);
+  PASS();
+}
+
+/* Test handles stay valid while the pool grows */
+TEST compact_tree_stable_handles(void) {
+  struct gbt_compact_dict *const dict = gbt_compact_construct_dict();
+  gbt_handle first;
+  int i;
+  ASSERT(dict != NULL);
+
+  first = gbt_compact_insert(dict, -1, -1);
+  for (i = 0; i < 10000; i++)
+    ASSERT(gbt_compact_insert(dict, i, i) != GBT_NIL);
+  ASSERT_EQ(gbt_compact_lookup(dict, -1), first);
+  ASSERT_EQ(gbt_compact_keyval(dict, first), -1);
+  ASSERT_EQ(gbt_compact_size(dict), 10001);
+  ASSERT(compact_is_valid(dict));
+
+  gbt_compact_destruct_dict(dict);
+  PASS();
+}
+
+/* Test deletion, slot reuse and rebalancing */
+TEST compact_tree_delete(void) {
+  struct gbt_compact_dict *const dict = gbt_compact_construct_dict();
+  int i;
+  ASSERT(dict != NULL);
+
+  for (i = 0; i < 1000; i++)
+    gbt_compact_insert(dict, (i * 7919) % 1000, i);
+  ASSERT_EQ(gbt_compact_size(dict), 1000);
+
+  for (i = 0; i < 1000; i += 3)
+    gbt_compact_delete(dict, i);
+  gbt_compact_delete(dict, 9999); /* deleting non-existing key */
+  ASSERT_EQ(gbt_compact_size(dict), 1000 - 334);
+  ASSERT(compact_is_valid(dict));
+  for (i = 0; i < 1000; i++)
+    ASSERT_EQ(gbt_compact_lookup(dict, i) == GBT_NIL, i % 3 == 0);
+
+  {
+    const size_t memory = gbt_compact_memory(dict);
+    for (i = 0; i < 1000; i += 3)
+      gbt_compact_insert(dict, i, i);
+    ASSERT_EQ(gbt_compact_memory(dict), memory); /* freed slots reused */
+  }
+
+  gbt_compact_balance(dict);
+  ASSERT(compact_is_valid(dict));
+  ASSERT_EQ(gbt_compact_size(dict), 1000);
+
+  gbt_compact_clear(dict);
+  ASSERT_EQ(gbt_compact_size(dict), 0);
+  ASSERT_EQ(gbt_compact_lookup(dict, 1), GBT_NIL);
+
+  gbt_compact_destruct_dict(dict);
+  PASS();
+}
+
+/* Test the per-node footprint is well below struct gbt_node */
+TEST compact_tree_footprint(void) {
+  struct gbt_compact_dict *const dict = gbt_compact_construct_dict();
+  int i;
+  ASSERT(dict != NULL);
+
+  for (i = 0; i < 4095; i++)
+    gbt_compact_insert(dict, i, i);
+  ASSERT(gbt_compact_memory(dict) / 4096 < sizeof(struct gbt_node));
+  ASSERT(gbt_compact_memory(dict) / 4096 <=
+         2 * sizeof(gbt_handle) + sizeof(gbt_ky_type) + sizeof(gbt_data_type));
+
+  gbt_compact_destruct_dict(dict);
+  PASS();
+}
+
+SUITE(gbt_compact_suite) {
+  RUN_TEST(compact_tree_insert_lookup);
+  RUN_TEST(compact_tree_stable_handles);
+  RUN_TEST(compact_tree_delete);
+  RUN_TEST(compact_tree_footprint);
+}
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !TEST_GBT_COMPACT_H */
@@ -0,0 +1,184 @@
+#ifndef TEST_GBT_SHARDED_H
+#define TEST_GBT_SHARDED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif /* _WIN32 */
+
+#include <gbt_sharded.h>
+#include <greatest.h>
+
+struct sharded_walk {
+  int last, count, ordered;
+};
+
+static int sharded_walk_visit(struct gbt_node *const node, void *const ctx) {
+  struct sharded_walk *const walk = (struct sharded_walk *)ctx;
+  if (walk->count && !(walk->last < node->key))
+    walk->ordered = 0;
+  walk->last = node->key;
+  walk->count++;
+  return 0;
+}
+
+/* Test range partitioning keeps walks ordered across shards */
+TEST sharded_tree_range(void) {
+  const gbt_ky_type splits[] = {100, 200, 300};
+  struct gbt_sharded_dict *const dict = gbt_sharded_construct_range(
+      splits, 3, NULL, NULL, NULL, NULL, NULL, NULL);
+  gbt_data_type out = 0;
+  int i;
+  ASSERT(dict != NULL);
+  ASSERT_EQ(gbt_sharded_shards(dict), 4);
+
+  for (i = 399; i >= 0; i--)
+    ASSERT_EQ(gbt_sharded_insert(dict, i, i), 1);
+  ASSERT_EQ(gbt_sharded_insert(dict, 150, -1), 0);
+  ASSERT_EQ(gbt_sharded_size(dict), 400);
+
+  ASSERT_EQ(gbt_sharded_lookup(dict, 150, &out), 1);
+  ASSERT(out == 150);
+  ASSERT_EQ(gbt_sharded_upsert(dict, 150, -150), 0);
+  ASSERT_EQ(gbt_sharded_lookup(dict, 150, &out), 1);
+  ASSERT(out == -150);
+  ASSERT_EQ(gbt_sharded_lookup(dict, 1000, &out), 0);
+
+  ASSERT_EQ(gbt_sharded_delete(dict, 200, &out), 1);
+  ASSERT(out == 200);
+  ASSERT_EQ(gbt_sharded_delete(dict, 200, NULL), 0);
+
+  {
+    struct sharded_walk walk = {0, 0, 1};
+    ASSERT_EQ(gbt_sharded_foreach(dict, sharded_walk_visit, &walk), 0);
+    ASSERT_EQ(walk.count, 399);
+    ASSERT(walk.ordered);
+  }
+  {
+    struct sharded_walk walk = {0, 0, 1};
+    gbt_sharded_foreach_range(dict, 90, 310, sharded_walk_visit, &walk);
+    ASSERT_EQ(walk.count, 219); /* 90..309 without 200 */
+    ASSERT(walk.ordered);
+    ASSERT_EQ(walk.last, 309);
+  }
+
+  gbt_sharded_clear(dict);
+  ASSERT_EQ(gbt_sharded_size(dict), 0);
+  gbt_sharded_destruct_dict(dict);
+  PASS();
+}
+
+/* Test hash partitioning */
+TEST sharded_tree_hash(void) {
+  struct gbt_sharded_dict *const dict =
+      gbt_sharded_construct_hash(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+  int i;
+  ASSERT(dict != NULL);
+
+  for (i = 0; i < 1000; i++)
+    ASSERT_EQ(gbt_sharded_insert(dict, i, i), 1);
+  for (i = 0; i < 1000; i += 2)
+    ASSERT_EQ(gbt_sharded_delete(dict, i, NULL), 1);
+  ASSERT_EQ(gbt_sharded_size(dict), 500);
+  for (i = 0; i < 1000; i++)
+    ASSERT_EQ(gbt_sharded_lookup(dict, i, NULL), i % 2);
+
+  {
+    struct sharded_walk walk = {0, 0, 1};
+    gbt_sharded_foreach_range(dict, 100, 200, sharded_walk_visit, &walk);
+    ASSERT_EQ(walk.count, 50);
+  }
+
+  gbt_sharded_destruct_dict(dict);
+  PASS();
+}
+
+struct sharded_writer {
+  struct gbt_sharded_dict *dict;
+  int first, count;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI sharded_writer_run(LPVOID arg)
+#else
+static void *sharded_writer_run(void *arg)
+#endif /* _WIN32 */
+{
+  const struct sharded_writer *const w = (const struct sharded_writer *)arg;
+  int i;
+  for (i = w->first; i < w->first + w->count; i++) {
+    gbt_sharded_insert(w->dict, i, i);
+    if (i % 3 == 0)
+      gbt_sharded_delete(w->dict, i, NULL);
+  }
+  return 0;
+}
+
+/* Test concurrent writers */
+TEST sharded_tree_threads(void) {
+  enum { writers = 4, per_writer = 5000 };
+  const gbt_ky_type splits[] = {per_writer, 2 * per_writer, 3 * per_writer};
+  struct gbt_sharded_dict *const dict = gbt_sharded_construct_range(
+      splits, 3, NULL, NULL, NULL, NULL, NULL, NULL);
+  struct sharded_writer w[writers];
+#ifdef _WIN32
+  HANDLE threads[writers];
+#else
+  pthread_t threads[writers];
+#endif /* _WIN32 */
+  int i;
+  ASSERT(dict != NULL);
+
+  for (i = 0; i < writers; i++) {
+    w[i].dict = dict;
+    /* each writer straddles two shards */
+    w[i].first = i * per_writer + per_writer / 2;
+    w[i].count = per_writer;
+#ifdef _WIN32
+    threads[i] = CreateThread(NULL, 0, sharded_writer_run, &w[i], 0, NULL);
+    ASSERT(threads[i] != NULL);
+#else
+    ASSERT_EQ(pthread_create(&threads[i], NULL, sharded_writer_run, &w[i]), 0);
+#endif /* _WIN32 */
+  }
+  for (i = 0; i < writers; i++) {
+#ifdef _WIN32
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+#else
+    pthread_join(threads[i], NULL);
+#endif /* _WIN32 */
+  }
+
+  {
+    size_t expected = 0;
+    for (i = w[0].first; i < w[writers - 1].first + per_writer; i++)
+      expected += i % 3 != 0;
+    ASSERT_EQ(gbt_sharded_size(dict), expected);
+  }
+  {
+    struct sharded_walk walk = {0, 0, 1};
+    gbt_sharded_foreach(dict, sharded_walk_visit, &walk);
+    ASSERT(walk.ordered);
+  }
+
+  gbt_sharded_destruct_dict(dict);
+  PASS();
+}
+
+SUITE(gbt_sharded_suite) {
+  RUN_TEST(sharded_tree_range);
+  RUN_TEST(sharded_tree_hash);
+  RUN_TEST(sharded_tree_threads);
+}
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !TEST_GBT_SHARDED_H */
@@ -0,0 +1,275 @@
+#ifndef TEST_GBT_SHM_H
+#define TEST_GBT_SHM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif /* _WIN32 */
+
+#include <gbt_shm.h>
+#include <gbt_shm_layout.h>
+#include <greatest.h>
+
+/* Segment names are system-wide: tag ours with the pid, so that test */
+/* runs going on at the same time leave each other's segments alone.  */
+static const char *shm_test_name(void) {
+  static char name[40];
+
+  if (!name[0])
+#ifdef _WIN32
+    sprintf(name, "Local\\gbt_test_shm_%lu",
+            (unsigned long)GetCurrentProcessId());
+#else
+    sprintf(name, "/gbt_test_shm_%ld", (long)getpid());
+#endif /* _WIN32 */
+  return name;
+}
+
+#define GBT_TEST_SHM shm_test_name()
+
+/* Test the writer, and a second mapping reading its updates */
+TEST shm_tree_basic(void) {
+  struct gbt_shm_dict *writer, *reader;
+  gbt_data_type out = 0;
+  int i;
+
+  gbt_shm_unlink(GBT_TEST_SHM);
+  writer = gbt_shm_create(GBT_TEST_SHM, 1000, NULL, NULL);
+  ASSERT(writer != NULL);
+  ASSERT(gbt_shm_create(GBT_TEST_SHM, 1000, NULL, NULL) == NULL);
+  reader = gbt_shm_open(GBT_TEST_SHM, NULL, NULL);
+  ASSERT(reader != NULL);
+  ASSERT_EQ(gbt_shm_memory(reader), gbt_shm_memory(writer));
+
+  for (i = 0; i < 1000; i++)
+    ASSERT_EQ(gbt_shm_insert(writer, i, i * 2), 1);
+  ASSERT_EQ(gbt_shm_insert(writer, 500, -1), 0);
+  ASSERT_EQ(gbt_shm_insert(writer, 1000, 0), -1); /* full */
+  ASSERT_EQ(gbt_shm_size(reader), 1000);
+
+  ASSERT_EQ(gbt_shm_lookup(reader, 500, &out), 1);
+  ASSERT(out == 1000);
+  ASSERT_EQ(gbt_shm_lookup(reader, 1000, &out), 0);
+
+  /* readers cannot write */
+  ASSERT_EQ(gbt_shm_insert(reader, 2000, 0), -1);
+  ASSERT_EQ(gbt_shm_delete(reader, 1), -1);
+
+  for (i = 0; i < 1000; i += 2)
+    ASSERT_EQ(gbt_shm_delete(writer, i), 1);
+  ASSERT_EQ(gbt_shm_delete(writer, 0), 0);
+  ASSERT_EQ(gbt_shm_size(reader), 500);
+  for (i = 0; i < 1000; i++)
+    ASSERT_EQ(gbt_shm_lookup(reader, i, NULL), i % 2);
+
+  /* freed nodes are reused */
+  for (i = 1000; i < 1500; i++)
+    ASSERT_EQ(gbt_shm_insert(writer, i, i), 1);
+  ASSERT_EQ(gbt_shm_insert(writer, 1500, 0), -1);
+  ASSERT_EQ(gbt_shm_lookup(reader, 1499, &out), 1);
+  ASSERT(out == 1499);
+
+  gbt_shm_clear(writer);
+  ASSERT_EQ(gbt_shm_size(reader), 0);
+  ASSERT_EQ(gbt_shm_lookup(reader, 1, NULL), 0);
+
+  gbt_shm_close(reader);
+  gbt_shm_close(writer);
+  ASSERT_EQ(gbt_shm_unlink(GBT_TEST_SHM), 0);
+  PASS();
+}
+
+struct shm_reader {
+  const char *name;
+  int keys, rounds, misses;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI shm_reader_run(LPVOID arg)
+#else
+static void *shm_reader_run(void *arg)
+#endif /* _WIN32 */
+{
+  struct shm_reader *const r = (struct shm_reader *)arg;
+  struct gbt_shm_dict *const D = gbt_shm_open(r->name, NULL, NULL);
+  gbt_data_type out;
+  int i, j;
+
+  if (!D) {
+    r->misses = -1;
+    return 0;
+  }
+  for (j = 0; j < r->rounds; j++)
+    for (i = 0; i < r->keys; i++) {
+      out = 0;
+      if (!gbt_shm_lookup(D, i * 2, &out) || out != i)
+        r->misses++;
+    }
+  gbt_shm_close(D);
+  return 0;
+}
+
+/* Test readers searching while the writer inserts, deletes and rebuilds */
+TEST shm_tree_concurrent(void) {
+  enum { readers = 2, keys = 2000 };
+  struct gbt_shm_dict *writer;
+  struct shm_reader r[readers];
+#ifdef _WIN32
+  HANDLE threads[readers];
+#else
+  pthread_t threads[readers];
+#endif /* _WIN32 */
+  int i, j;
+
+  gbt_shm_unlink(GBT_TEST_SHM);
+  writer = gbt_shm_create(GBT_TEST_SHM, 4 * keys, NULL, NULL);
+  ASSERT(writer != NULL);
+  /* even keys stay put; odd keys churn */
+  for (i = 0; i < keys; i++)
+    ASSERT_EQ(gbt_shm_insert(writer, i * 2, i), 1);
+
+  for (i = 0; i < readers; i++) {
+    r[i].name = GBT_TEST_SHM;
+    r[i].keys = keys;
+    r[i].rounds = 20;
+    r[i].misses = 0;
+#ifdef _WIN32
+    threads[i] = CreateThread(NULL, 0, shm_reader_run, &r[i], 0, NULL);
+    ASSERT(threads[i] != NULL);
+#else
+    ASSERT_EQ(pthread_create(&threads[i], NULL, shm_reader_run, &r[i]), 0);
+#endif /* _WIN32 */
+  }
+  for (j = 0; j < 10; j++) {
+    for (i = 0; i < keys; i++)
+      gbt_shm_insert(writer, i * 2 + 1, -1);
+    for (i = 0; i < keys; i++)
+      gbt_shm_delete(writer, i * 2 + 1);
+  }
+  for (i = 0; i < readers; i++) {
+#ifdef _WIN32
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+#else
+    pthread_join(threads[i], NULL);
+#endif /* _WIN32 */
+    ASSERT_EQ(r[i].misses, 0);
+  }
+  ASSERT_EQ(gbt_shm_size(writer), keys);
+
+  gbt_shm_close(writer);
+  gbt_shm_unlink(GBT_TEST_SHM);
+  PASS();
+}
+
+/* Test a reader process, with a mapping of its own, searching while the
+   writer inserts, deletes and rebuilds */
+TEST shm_tree_processes(void) {
+#ifdef _WIN32
+  SKIPm("needs fork");
+#else
+  enum { keys = 2000 };
+  struct gbt_shm_dict *writer;
+  struct shm_reader r;
+  pid_t pid;
+  int i, j, status;
+
+  gbt_shm_unlink(GBT_TEST_SHM);
+  writer = gbt_shm_create(GBT_TEST_SHM, 4 * keys, NULL, NULL);
+  ASSERT(writer != NULL);
+  for (i = 0; i < keys; i++)
+    ASSERT_EQ(gbt_shm_insert(writer, i * 2, i), 1);
+
+  fflush(NULL);
+  pid = fork();
+  if (pid == 0) {
+    /* The writer's mapping is inherited, so the segment is mapped again
+       at another address. */
+    r.name = GBT_TEST_SHM;
+    r.keys = keys;
+    r.rounds = 20;
+    r.misses = 0;
+    shm_reader_run(&r);
+    _exit(r.misses == 0 ? 0 : 1);
+  }
+  ASSERT(pid > 0);
+  for (j = 0; j < 10; j++) {
+    for (i = 0; i < keys; i++)
+      gbt_shm_insert(writer, i * 2 + 1, -1);
+    for (i = 0; i < keys; i++)
+      gbt_shm_delete(writer, i * 2 + 1);
+  }
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT(WIFEXITED(status));
+  ASSERT_EQ(WEXITSTATUS(status), 0);
+
+  gbt_shm_close(writer);
+  gbt_shm_unlink(GBT_TEST_SHM);
+  PASS();
+#endif /* _WIN32 */
+}
+
+/* Test readers give up on a writer that died during an update */
+TEST shm_tree_dead_writer(void) {
+#ifdef _WIN32
+  SKIPm("needs a second writable mapping");
+#else
+  struct gbt_shm_dict *writer, *reader;
+  volatile struct gbt_shm_header *head;
+  void *base;
+  int fd;
+
+  gbt_shm_unlink(GBT_TEST_SHM);
+  writer = gbt_shm_create(GBT_TEST_SHM, 16, NULL, NULL);
+  ASSERT(writer != NULL);
+  ASSERT_EQ(gbt_shm_insert(writer, 1, 1), 1);
+  reader = gbt_shm_open(GBT_TEST_SHM, NULL, NULL);
+  ASSERT(reader != NULL);
+
+  /* Leave the sequence number odd, as a writer killed between starting
+     and finishing an update would. */
+  fd = shm_open(GBT_TEST_SHM, O_RDWR, 0);
+  ASSERT(fd >= 0);
+  base = mmap(NULL, gbt_shm_memory(reader), PROT_READ | PROT_WRITE,
+              MAP_SHARED, fd, 0);
+  close(fd);
+  ASSERT(base != MAP_FAILED);
+  head = (volatile struct gbt_shm_header *)base;
+  head->seq++;
+  ASSERT_EQ(gbt_shm_lookup(reader, 1, NULL), -1);
+  ASSERT_EQ(gbt_shm_size(reader), GBT_SIZE_MAX);
+  head->seq++;
+  ASSERT_EQ(gbt_shm_lookup(reader, 1, NULL), 1);
+
+  munmap(base, gbt_shm_memory(reader));
+  gbt_shm_close(reader);
+  gbt_shm_close(writer);
+  gbt_shm_unlink(GBT_TEST_SHM);
+  PASS();
+#endif /* _WIN32 */
+}
+
+SUITE(gbt_shm_suite) {
+  RUN_TEST(shm_tree_basic);
+  RUN_TEST(shm_tree_concurrent);
+  RUN_TEST(shm_tree_processes);
+  RUN_TEST(shm_tree_dead_writer);
+}
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !TEST_GBT_SHM_H */
@@ -17,6 +17,48 @@ static void insert_keys(struct gbt_dict *const dict, const int keys[],
   }
 }
 
+/* Height of a subtree (0 for an empty one) */
+static long tree_height(const struct gbt_node *const t) {
+  long l, r;
+  if (!t)
+    return 0;
+  l = tree_height(t->left);
+  r = tree_height(t->right);
+  return 1 + (l > r ? l : r);
+}
+
+/* Checks in-order keys are strictly increasing; returns the node count */
+static size_t tree_check_order(const struct gbt_node *const t,
+                               const struct gbt_node **const prev,
+                               int *const ok) {
+  size_t n;
+  if (!t)
+    return 0;
+  n = tree_check_order(t->left, prev, ok);
+  if (*prev && !((*prev)->key < t->key))
+    *ok = 0;
+  *prev = t;
+  return n + 1 + tree_check_order(t->right, prev, ok);
+}
+
+static int tree_is_valid(const struct gbt_dict *const dict) {
+  const struct gbt_node *prev = NULL;
+  int ok = 1;
+  return tree_check_order(dict->t, &prev, &ok) == dict->weight - 1 && ok;
+}
+
+static unsigned long comparisons = 0;
+
+static int counting_key_less(const gbt_ky_type a, const gbt_ky_type b) {
+  comparisons++;
+  return a < b;
+}
+
+static int counting_key_equal(const gbt_ky_type a, const gbt_ky_type b) {
+  comparisons++;
+  return a == b;
+}
+
 /* Test insertion, gbt_lookup, and gbt_size */
 TEST general_balanced_tree_insert_lookup_size(void) {
   struct gbt_dict *const dict = gbt_construct_dict();
@@ -188,6 +230,816 @@ TEST general_balanced_tree_large_insert_delete(void) {
   PASS();
 }
 
+/* Test gbt_insert_ex reports whether a node was created */
+TEST general_balanced_tree_insert_ex(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  int created = -1;
+  ASSERT(dict != NULL);
+
+  {
+    struct gbt_node *const n1 = gbt_insert_ex(dict, 7, 70, &created);
+    ASSERT(n1 != NULL);
+    ASSERT_EQ(created, 1);
+
+    {
+      struct gbt_node *const n2 = gbt_insert_ex(dict, 7, 700, &created);
+      ASSERT(n2 == n1);
+      ASSERT_EQ(created, 0);
+      ASSERT(*gbt_infoval(dict, n2) == 70); /* data unchanged */
+    }
+    ASSERT(gbt_insert_ex(dict, 8, 80, NULL) != NULL);
+    ASSERT_EQ(gbt_size(dict), 2);
+  }
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+/* Test gbt_upsert overwrites existing data */
+TEST general_balanced_tree_upsert(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  ASSERT(dict != NULL);
+
+  {
+    struct gbt_node *const n1 = gbt_upsert(dict, 42, 100);
+    ASSERT(n1 != NULL);
+    ASSERT(*gbt_infoval(dict, n1) == 100);
+
+    {
+      struct gbt_node *const n2 = gbt_upsert(dict, 42, 200);
+      ASSERT(n2 == n1);
+      ASSERT(*gbt_infoval(dict, n2) == 200);
+    }
+    ASSERT_EQ(gbt_size(dict), 1);
+  }
+  {
+    int created = -1;
+    ASSERT(gbt_upsert_ex(dict, 42, 300, &created) != NULL);
+    ASSERT_EQ(created, 0);
+    ASSERT(gbt_upsert_ex(dict, 43, 300, &created) != NULL);
+    ASSERT_EQ(created, 1);
+    ASSERT(*gbt_infoval(dict, gbt_lookup(dict, 42)) == 300);
+  }
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+static void count_ctor(gbt_data_type *const dst, const gbt_ky_type key,
+                       void *const ctx) {
+  ++*(int *)ctx;
+  *dst = key * 10;
+}
+
+/* Test gbt_get_or_insert only constructs data for new keys */
+TEST general_balanced_tree_get_or_insert(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  int calls = 0;
+  ASSERT(dict != NULL);
+
+  {
+    struct gbt_node *const n1 =
+        gbt_get_or_insert(dict, 3, count_ctor, &calls);
+    ASSERT(n1 != NULL);
+    ASSERT_EQ(calls, 1);
+    ASSERT(*gbt_infoval(dict, n1) == 30);
+
+    {
+      struct gbt_node *const n2 =
+          gbt_get_or_insert(dict, 3, count_ctor, &calls);
+      ASSERT(n2 == n1);
+      ASSERT_EQ(calls, 1); /* not constructed again */
+    }
+    ASSERT_EQ(gbt_size(dict), 1);
+  }
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+/* Test gbt_delete_get hands back the removed data */
+TEST general_balanced_tree_delete_get(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  gbt_data_type out = 0;
+  ASSERT(dict != NULL);
+
+  {
+    const int keys[] = {5, 15, 25, 35};
+    insert_keys(dict, keys, sizeof(keys) / sizeof(keys[0]));
+
+    ASSERT_EQ(gbt_delete_get(dict, 15, &out), 1);
+    ASSERT(out == 15);
+    ASSERT(gbt_lookup(dict, 15) == NULL);
+    ASSERT_EQ(gbt_size(dict), 3);
+
+    ASSERT_EQ(gbt_delete_get(dict, 15, &out), 0);
+    ASSERT_EQ(gbt_delete_get(dict, 35, NULL), 1);
+    ASSERT_EQ(gbt_size(dict), 2);
+  }
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+/* Test sorted inserts through a cursor cost O(1) comparisons each */
+TEST general_balanced_tree_cursor_insert_sorted(void) {
+  struct gbt_dict *const dict =
+      gbt_construct_dict_full(NULL, counting_key_less, counting_key_equal,
+                              NULL, NULL, NULL);
+  struct gbt_cursor cursor;
+  const int n = 10000;
+  int i;
+  ASSERT(dict != NULL);
+
+  gbt_cursor_init(dict, &cursor);
+  comparisons = 0;
+  for (i = 0; i < n; i++) {
+    struct gbt_node *const node = gbt_cursor_insert(&cursor, i, i);
+    ASSERT(node != NULL);
+    ASSERT_EQ(gbt_keyval(dict, node), i);
+  }
+  ASSERT(comparisons < 8UL * n);
+  ASSERT_EQ(gbt_size(dict), (size_t)n);
+  ASSERT(tree_is_valid(dict));
+
+  /* duplicates and out-of-order keys through the same cursor */
+  ASSERT(*gbt_infoval(dict, gbt_cursor_insert(&cursor, 5000, -1)) == 5000);
+  ASSERT(gbt_cursor_insert(&cursor, -7, -7) != NULL);
+  ASSERT(gbt_cursor_insert(&cursor, 20000, 1) != NULL);
+  ASSERT_EQ(gbt_size(dict), (size_t)n + 2);
+  ASSERT(tree_is_valid(dict));
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+/* Test gbt_append, including keys that are not past the maximum */
+TEST general_balanced_tree_append(void) {
+  struct gbt_dict *const dict =
+      gbt_construct_dict_full(NULL, counting_key_less, counting_key_equal,
+                              NULL, NULL, NULL);
+  const int n = 10000;
+  int i;
+  ASSERT(dict != NULL);
+
+  comparisons = 0;
+  for (i = 0; i < n; i++)
+    ASSERT(gbt_append(dict, 2 * i, i) != NULL);
+  ASSERT(comparisons < 4UL * n);
+  ASSERT_EQ(gbt_size(dict), (size_t)n);
+
+  ASSERT(gbt_append(dict, 3, 3) != NULL);   /* falls back */
+  ASSERT(gbt_append(dict, 4, 4) != NULL);   /* duplicate */
+  ASSERT(gbt_append(dict, 2 * n, 1) != NULL);
+  gbt_delete(dict, 2 * n); /* invalidates the cached path */
+  ASSERT(gbt_append(dict, 2 * n + 2, 1) != NULL);
+  ASSERT_EQ(gbt_size(dict), (size_t)n + 2);
+  ASSERT(tree_is_valid(dict));
+  ASSERT(gbt_lookup(dict, 3) != NULL);
+  ASSERT(gbt_lookup(dict, 2 * n + 2) != NULL);
+  gbt_destruct_dict(dict);
+
+  /* the cursor is unpositioned after plain inserts and after clearing */
+  {
+    struct gbt_dict *const fresh = gbt_construct_dict();
+    ASSERT(fresh != NULL);
+    gbt_insert(fresh, 1, 1);
+    ASSERT(gbt_append(fresh, 2, 2) != NULL);
+    gbt_clear(fresh);
+    gbt_insert(fresh, 1, 1);
+    ASSERT(gbt_append(fresh, 2, 2) != NULL);
+    ASSERT(gbt_append(fresh, 3, 3) != NULL);
+    ASSERT_EQ(gbt_size(fresh), 3);
+    ASSERT(tree_is_valid(fresh));
+    gbt_destruct_dict(fresh);
+  }
+  PASS();
+}
+
+/* Test gbt_insert_next with a near-sorted stream and interleaved deletes */
+TEST general_balanced_tree_insert_next(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  struct gbt_node *node;
+  int i;
+  ASSERT(dict != NULL);
+
+  for (i = 0; i < 5000; i++) {
+    const int key = i + (i % 7 == 3 ? -3 : 0) + (i % 11 == 5 ? 4 : 0);
+    node = gbt_insert_next(dict, key, key);
+    ASSERT(node != NULL);
+    ASSERT_EQ(gbt_keyval(dict, node), key);
+    if (i % 13 == 0)
+      gbt_delete(dict, key - 1);
+  }
+  ASSERT(tree_is_valid(dict));
+  ASSERT(gbt_lookup(dict, 4998) != NULL);
+
+  /* the search starts over once the path is stale */
+  gbt_clear(dict);
+  ASSERT(gbt_insert_next(dict, 1, 1) != NULL);
+  ASSERT_EQ(gbt_size(dict), 1);
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+struct collect_keys {
+  int keys[64];
+  int count, stop_at;
+};
+
+static int collect_visit(struct gbt_node *const node, void *const ctx) {
+  struct collect_keys *const c = (struct collect_keys *)ctx;
+  c->keys[c->count++] = node->key;
+  return c->count == c->stop_at ? 42 : 0;
+}
+
+/* Test in-order walks over the whole tree and over [lo, hi) */
+TEST general_balanced_tree_foreach(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  int i;
+  ASSERT(dict != NULL);
+
+  for (i = 0; i < 50; i++)
+    gbt_insert(dict, (i * 31) % 50, i);
+
+  {
+    struct collect_keys c = {{0}, 0, -1};
+    ASSERT_EQ(gbt_foreach(dict, collect_visit, &c), 0);
+    ASSERT_EQ(c.count, 50);
+    for (i = 0; i < 50; i++)
+      ASSERT_EQ(c.keys[i], i);
+  }
+  {
+    struct collect_keys c = {{0}, 0, -1};
+    ASSERT_EQ(gbt_foreach_range(dict, 10, 20, collect_visit, &c), 0);
+    ASSERT_EQ(c.count, 10);
+    ASSERT_EQ(c.keys[0], 10);
+    ASSERT_EQ(c.keys[9], 19);
+  }
+  {
+    struct collect_keys c = {{0}, 0, 3};
+    ASSERT_EQ(gbt_foreach_range(dict, 45, 100, collect_visit, &c), 42);
+    ASSERT_EQ(c.count, 3);
+  }
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+/* Test lazy deletion leaves reusable tombstones */
+TEST general_balanced_tree_lazy_delete(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  struct gbt_node *node;
+  gbt_data_type out = 0;
+  int created = 0;
+  ASSERT(dict != NULL);
+
+  gbt_set_lazy_delete(dict, 1);
+  {
+    const int keys[] = {10, 20, 30, 40, 50, 60};
+    insert_keys(dict, keys, sizeof(keys) / sizeof(keys[0]));
+  }
+  node = gbt_lookup(dict, 30);
+  ASSERT(node != NULL);
+
+  ASSERT_EQ(gbt_delete_get(dict, 30, &out), 1);
+  ASSERT(out == 30);
+  ASSERT_EQ(gbt_delete_get(dict, 30, &out), 0); /* already dead */
+  ASSERT(gbt_lookup(dict, 30) == NULL);
+  ASSERT_EQ(gbt_size(dict), 5);
+  ASSERT_EQ(dict->weight, 7); /* the node is still linked in */
+
+  {
+    struct collect_keys c = {{0}, 0, -1};
+    gbt_foreach(dict, collect_visit, &c);
+    ASSERT_EQ(c.count, 5);
+    ASSERT_EQ(c.keys[2], 40);
+  }
+
+  /* re-inserting the key reuses the tombstone */
+  ASSERT(gbt_insert_ex(dict, 30, 300, &created) == node);
+  ASSERT_EQ(created, 1);
+  ASSERT(*gbt_infoval(dict, node) == 300);
+  ASSERT_EQ(gbt_size(dict), 6);
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+/* Test tombstones are freed by partial and global rebuilds */
+TEST general_balanced_tree_lazy_delete_purge(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  int i;
+  ASSERT(dict != NULL);
+
+  gbt_set_lazy_delete(dict, 1);
+  for (i = 0; i < 1000; i++)
+    gbt_insert(dict, i, i);
+  for (i = 0; i < 1000; i += 4)
+    gbt_delete(dict, i);
+  ASSERT_EQ(dict->numofdead, 250);
+  ASSERT_EQ(gbt_size(dict), 750);
+
+  /* sorted inserts keep rebuilding subtrees on the right spine */
+  for (i = 1000; i < 3000; i++)
+    gbt_insert(dict, i, i);
+  ASSERT(dict->numofdead < 250);
+  ASSERT_EQ(gbt_size(dict), 2750);
+  ASSERT(tree_is_valid(dict));
+
+  /* deleting more than half forces a global purge */
+  for (i = 0; i < 3000; i++)
+    gbt_delete(dict, i);
+  ASSERT_EQ(gbt_size(dict), 0);
+  ASSERT(dict->weight - 1 < 2 * 2750 / 3);
+  ASSERT(tree_is_valid(dict));
+
+  for (i = 0; i < 100; i++)
+    gbt_insert(dict, i, i);
+  gbt_delete(dict, 5);
+  gbt_set_lazy_delete(dict, 0); /* purges what is left */
+  ASSERT_EQ(dict->numofdead, 0);
+  ASSERT_EQ(dict->weight, 100);
+  gbt_delete(dict, 6); /* physical again */
+  ASSERT_EQ(dict->weight, 99);
+  ASSERT(tree_is_valid(dict));
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+/* Test both rebuild kernels give a perfectly balanced tree */
+TEST general_balanced_tree_rebuild_kernels(void) {
+  const int kernels[] = {GBT_REBUILD_SKEW, GBT_REBUILD_FLATTEN};
+  size_t k;
+
+  for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    struct gbt_dict *const dict = gbt_construct_dict();
+    int i;
+    ASSERT(dict != NULL);
+    gbt_set_rebuild_kernel(dict, kernels[k]);
+
+    for (i = 0; i < 5000; i++) /* sorted: many partial rebuilds */
+      gbt_insert(dict, i, i);
+    for (i = 0; i < 5000; i += 2)
+      gbt_delete(dict, i);
+    ASSERT(tree_is_valid(dict));
+
+    gbt_balance(dict);
+    ASSERT(tree_is_valid(dict));
+    ASSERT_EQ(tree_height(dict->t), 12); /* ceil(log2(2500 + 1)) */
+
+    /* tombstones are dropped by the rebuild */
+    gbt_set_lazy_delete(dict, 1);
+    for (i = 1; i < 5000; i += 4)
+      gbt_delete(dict, i);
+    ASSERT_EQ(dict->numofdead, 1250);
+    gbt_balance(dict);
+    ASSERT_EQ(dict->numofdead, 0);
+    ASSERT_EQ(gbt_size(dict), 1250);
+    ASSERT(tree_is_valid(dict));
+    ASSERT_EQ(tree_height(dict->t), 11);
+    for (i = 0; i < 5000; i++)
+      ASSERT_EQ(gbt_lookup(dict, i) != NULL, i % 4 == 3);
+
+    gbt_destruct_dict(dict);
+  }
+  PASS();
+}
+
+static size_t constant_hash(const gbt_ky_type _) { return 42; }
+
+/* Test the membership filter never hides a stored key */
+TEST general_balanced_tree_filter(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  struct gbt_filter_stats before, after;
+  int i;
+  ASSERT(dict != NULL);
+
+  ASSERT_EQ(gbt_set_filter(dict, 1), 1);
+  for (i = 0; i < 4000; i++) /* the filter grows on the way */
+    gbt_insert(dict, 2 * i, i);
+  for (i = 0; i < 4000; i++)
+    ASSERT(gbt_lookup(dict, 2 * i) != NULL);
+
+  gbt_filter_stats(dict, &before);
+  for (i = 0; i < 4000; i++)
+    ASSERT(gbt_lookup(dict, 2 * i + 1) == NULL);
+  gbt_filter_stats(dict, &after);
+  ASSERT_EQ(after.keys, 4000);
+  ASSERT(after.bytes >= 4000 * GBT_FILTER_BITS / 8);
+  ASSERT(after.fp_rate > 0.0 && after.fp_rate < 0.05);
+  ASSERT_EQ(after.queries - before.queries, 4000);
+  ASSERT(after.negatives - before.negatives > 3800);
+
+  /* deletions leave stale bits until the global rebuild drops them */
+  for (i = 0; i < 3900; i++)
+    ASSERT_EQ(gbt_delete_get(dict, 2 * i, NULL), 1);
+  ASSERT_EQ(gbt_delete_get(dict, 1, NULL), 0);
+  gbt_filter_stats(dict, &after);
+  ASSERT(after.keys < 4000);
+  for (i = 0; i < 3900; i++)
+    ASSERT(gbt_lookup(dict, 2 * i) == NULL);
+  for (i = 3900; i < 4000; i++)
+    ASSERT(gbt_lookup(dict, 2 * i) != NULL);
+
+  /* tombstones brought back are seen again */
+  gbt_set_lazy_delete(dict, 1);
+  ASSERT_EQ(gbt_delete_get(dict, 7800, NULL), 1);
+  ASSERT(gbt_lookup(dict, 7800) == NULL);
+  gbt_insert(dict, 7800, 0);
+  ASSERT(gbt_lookup(dict, 7800) != NULL);
+
+  /* a poor hash only costs false positives */
+  gbt_set_key_hash(dict, constant_hash);
+  for (i = 3900; i < 4000; i++)
+    ASSERT(gbt_lookup(dict, 2 * i) != NULL);
+  ASSERT(gbt_lookup(dict, 1) == NULL);
+
+  gbt_clear(dict);
+  ASSERT(gbt_lookup(dict, 7800) == NULL);
+  gbt_insert(dict, 5, 0);
+  ASSERT(gbt_lookup(dict, 5) != NULL);
+
+  ASSERT_EQ(gbt_set_filter(dict, 0), 1);
+  gbt_filter_stats(dict, &after);
+  ASSERT_EQ(after.bytes, 0);
+  ASSERT(gbt_lookup(dict, 5) != NULL);
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+/* Test cached references survive rebuilds but not deletion */
+TEST general_balanced_tree_cache(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  struct gbt_cache_stats s;
+  struct gbt_node *node;
+  int i;
+  ASSERT(dict != NULL);
+
+  ASSERT_EQ(gbt_set_cache(dict, 100), 1);
+  gbt_cache_stats(dict, &s);
+  ASSERT_EQ(s.slots, 128);
+  for (i = 0; i < 1000; i++)
+    gbt_insert(dict, i, i);
+
+  node = gbt_lookup(dict, 500);
+  ASSERT(node != NULL);
+  ASSERT(gbt_lookup(dict, 500) == node);
+  gbt_cache_stats(dict, &s);
+  ASSERT_EQ(s.hits, 1);
+  ASSERT_EQ(s.misses, 1);
+
+  /* rebuilds move nodes around, but keep them */
+  gbt_balance(dict);
+  for (i = 1000; i < 2000; i++)
+    gbt_insert(dict, i, i);
+  ASSERT(gbt_lookup(dict, 500) == node);
+  gbt_cache_stats(dict, &s);
+  ASSERT_EQ(s.hits, 2);
+
+  /* deletion drops freed nodes; nodes moved up keep their entries */
+  ASSERT(gbt_lookup(dict, 501) != NULL);
+  for (i = 0; i < 1000; i += 2)
+    gbt_delete(dict, i);
+  ASSERT(gbt_lookup(dict, 500) == NULL);
+  for (i = 1; i < 1000; i += 2) {
+    node = gbt_lookup(dict, i);
+    ASSERT(node != NULL && gbt_keyval(dict, node) == i);
+  }
+
+  gbt_set_lazy_delete(dict, 1);
+  ASSERT(gbt_lookup(dict, 501) != NULL);
+  gbt_cache_stats(dict, &s);
+  i = (int)(s.hits + s.misses);
+  gbt_delete(dict, 501);
+  gbt_delete(dict, 503);
+  gbt_cache_stats(dict, &s);
+  ASSERT_EQ((int)(s.hits + s.misses), i); /* deletes are not lookups */
+  ASSERT(gbt_lookup(dict, 501) == NULL);
+  ASSERT(gbt_lookup(dict, 503) == NULL);
+  gbt_insert(dict, 501, 0);
+  gbt_insert(dict, 503, 0);
+  ASSERT(gbt_lookup(dict, 501) != NULL);
+
+  /* colliding keys share a slot */
+  gbt_set_key_hash(dict, constant_hash);
+  for (i = 1; i < 1000; i += 2)
+    ASSERT(gbt_keyval(dict, gbt_lookup(dict, i)) == i);
+
+  gbt_clear(dict);
+  ASSERT(gbt_lookup(dict, 501) == NULL);
+  ASSERT_EQ(gbt_set_cache(dict, 0), 1);
+  gbt_insert(dict, 3, 0);
+  ASSERT(gbt_lookup(dict, 3) != NULL);
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+static long equal_calls;
+
+static int counting_equal(const gbt_ky_type a, const gbt_ky_type b) {
+  equal_calls++;
+  return a == b;
+}
+
+/* Test stored key hashes spare key_equal calls without changing results */
+TEST general_balanced_tree_key_hashing(void) {
+  struct gbt_dict *const dict =
+      gbt_construct_dict_full(NULL, NULL, counting_equal, NULL, NULL, NULL);
+  struct gbt_node *node;
+  long before;
+  int i;
+  ASSERT(dict != NULL);
+
+  for (i = 0; i < 500; i++)
+    gbt_insert(dict, 2 * i, i);
+  gbt_set_key_hashing(dict, 1); /* hashes the nodes already there */
+  for (i = 500; i < 1000; i++)
+    gbt_insert(dict, 2 * i, i);
+
+  before = equal_calls;
+  for (i = 0; i < 1000; i++) {
+    node = gbt_lookup(dict, 2 * i);
+    ASSERT(node != NULL && *gbt_infoval(dict, node) == i);
+  }
+  ASSERT(equal_calls - before <= 1000 + 10);
+  before = equal_calls;
+  for (i = 0; i < 1000; i++)
+    ASSERT(gbt_lookup(dict, 2 * i + 1) == NULL);
+  ASSERT(equal_calls - before <= 10);
+
+  /* inserts of present keys find them; deletion is unaffected */
+  gbt_insert(dict, 10, -1);
+  ASSERT_EQ(gbt_size(dict), 1000);
+  ASSERT_EQ(*gbt_infoval(dict, gbt_lookup(dict, 10)), 5);
+  gbt_set_lazy_delete(dict, 1);
+  gbt_delete(dict, 10);
+  ASSERT(gbt_lookup(dict, 10) == NULL);
+  gbt_insert(dict, 10, 5);
+  ASSERT(gbt_lookup(dict, 10) != NULL);
+
+  /* a new hash function rehashes the tree; colliding hashes still work */
+  gbt_set_key_hash(dict, constant_hash);
+  ASSERT_EQ(gbt_set_cache(dict, 64), 1);
+  for (i = 0; i < 1000; i++) {
+    ASSERT(gbt_lookup(dict, 2 * i) != NULL);
+    ASSERT(gbt_lookup(dict, 2 * i + 1) == NULL);
+  }
+
+  gbt_set_key_hashing(dict, 0);
+  ASSERT(gbt_lookup(dict, 1998) != NULL);
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+#ifdef GBT_AUGMENT
+static gbt_data_type sum_combine(const gbt_data_type a,
+                                 const gbt_data_type b) {
+  return a + b;
+}
+
+/* Associative but not commutative: the leftmost non-negative datum */
+static gbt_data_type first_combine(const gbt_data_type a,
+                                   const gbt_data_type b) {
+  return a >= 0 ? a : b;
+}
+
+static int range_matches(struct gbt_dict *const dict, const long ref[],
+                         const int lo, const int hi) {
+  long sum = 0, first = -1;
+  int k;
+
+  for (k = lo; k < hi && k < 500; k++)
+    if (ref[k] >= 0) {
+      sum += ref[k];
+      if (first < 0)
+        first = ref[k];
+    }
+  return gbt_aggregate_range(dict, lo, hi) ==
+         (dict->combine == sum_combine ? sum : first);
+}
+
+/* Test range aggregates against a reference array through updates */
+TEST general_balanced_tree_aggregate_range(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  long ref[500];
+  unsigned long seed = 7;
+  int i, k, lo, hi;
+  ASSERT(dict != NULL);
+
+  for (k = 0; k < 500; k++)
+    ref[k] = -1;
+  ASSERT(gbt_aggregate_range(dict, 0, 500) == 0); /* no aggregates yet */
+  gbt_set_augment(dict, sum_combine, 0);
+  for (i = 0; i < 20000; i++) {
+    seed = (seed * 1103515245UL + 12345UL) & 0x7fffffffUL;
+    k = (int)(seed >> 8) % 500;
+    switch ((seed >> 4) % 7) {
+    case 0:
+    case 1:
+      if (ref[k] < 0)
+        ref[k] = i;
+      gbt_insert(dict, k, i);
+      break;
+    case 2:
+      ref[k] = i;
+      gbt_upsert(dict, k, i);
+      break;
+    case 3:
+      ref[k] = -1;
+      gbt_delete(dict, k);
+      break;
+    case 4:
+      if (ref[k] < 0)
+        ref[k] = i;
+      gbt_append(dict, k, i);
+      break;
+    case 5:
+      if (gbt_pop_min(dict, &k, NULL))
+        ref[k] = -1;
+      break;
+    default:
+      gbt_set_lazy_delete(dict, (seed >> 12) & 1);
+      gbt_set_rebuild_kernel(dict, (int)(seed >> 13) & 1);
+      break;
+    }
+    if (i % 100 == 0) {
+      lo = (int)(seed >> 3) % 500;
+      hi = lo + (int)(seed >> 11) % 100;
+      ASSERT(range_matches(dict, ref, lo, hi));
+      ASSERT(range_matches(dict, ref, 0, 500));
+    }
+  }
+  ASSERT(tree_is_valid(dict));
+
+  gbt_set_augment(dict, first_combine, -1);
+  for (lo = 0; lo < 500; lo += 37)
+    for (hi = lo; hi <= 500; hi += 53)
+      ASSERT(range_matches(dict, ref, lo, hi));
+  gbt_balance(dict);
+  ASSERT(range_matches(dict, ref, 0, 500));
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+#endif /* GBT_AUGMENT */
+
+static const struct gbt_node *leftmost(const struct gbt_node *t) {
+  while (t && t->left)
+    t = t->left;
+  return t;
+}
+
+static const struct gbt_node *rightmost(const struct gbt_node *t) {
+  while (t && t->right)
+    t = t->right;
+  return t;
+}
+
+/* Test min/max and pops as a double-ended priority queue */
+TEST general_balanced_tree_min_max_pop(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  int ref[1000], i, k, lo, hi;
+  unsigned long seed = 11;
+  gbt_ky_type key;
+  gbt_data_type out;
+  ASSERT(dict != NULL);
+
+  ASSERT(gbt_min(dict) == NULL && gbt_max(dict) == NULL);
+  ASSERT_EQ(gbt_pop_min(dict, &key, &out), 0);
+  for (k = 0; k < 1000; k++)
+    ref[k] = 0;
+  for (i = 0; i < 30000; i++) {
+    seed = (seed * 1103515245UL + 12345UL) & 0x7fffffffUL;
+    k = (int)(seed >> 8) % 1000;
+    for (lo = 0; lo < 1000 && !ref[lo]; lo++)
+      ;
+    for (hi = 999; hi >= 0 && !ref[hi]; hi--)
+      ;
+    switch ((seed >> 4) % 8) {
+    case 0:
+    case 1:
+    case 2:
+      ref[k] = 1;
+      gbt_insert(dict, k, k);
+      break;
+    case 3:
+      ref[k] = 0;
+      gbt_delete(dict, k);
+      break;
+    case 4:
+      ASSERT_EQ(gbt_pop_min(dict, &key, &out), lo < 1000);
+      if (lo < 1000) {
+        ASSERT_EQ(key, lo);
+        ASSERT(out == lo);
+        ref[lo] = 0;
+      }
+      break;
+    case 5:
+      ASSERT_EQ(gbt_pop_max(dict, NULL, &out), hi >= 0);
+      if (hi >= 0) {
+        ASSERT(out == hi);
+        ref[hi] = 0;
+      }
+      break;
+    case 6:
+      if (lo < 1000) {
+        ASSERT_EQ(gbt_keyval(dict, gbt_min(dict)), lo);
+        ASSERT_EQ(gbt_keyval(dict, gbt_max(dict)), hi);
+      } else
+        ASSERT(gbt_min(dict) == NULL && gbt_max(dict) == NULL);
+      break;
+    default:
+      gbt_set_lazy_delete(dict, (seed >> 12) & 1);
+      gbt_set_rebuild_kernel(dict, (int)(seed >> 13) & 1);
+      break;
+    }
+    ASSERT(dict->min == leftmost(dict->t));
+    ASSERT(dict->max == rightmost(dict->t));
+    ASSERT(dict->weight <= 3 ||
+           dict->numofdeletions <= GBT_MAXDEL * dict->weight);
+  }
+  ASSERT(tree_is_valid(dict));
+
+  /* drain in order, through tombstones */
+  gbt_set_lazy_delete(dict, 1);
+  for (k = 0; k < 1000; k += 3)
+    if (ref[k]) {
+      gbt_delete(dict, k);
+      ref[k] = 0;
+    }
+  for (k = 0; k < 1000; k++)
+    if (ref[k]) {
+      ASSERT_EQ(gbt_keyval(dict, gbt_min(dict)), k);
+      ASSERT_EQ(gbt_pop_min(dict, &key, NULL), 1);
+      ASSERT_EQ(key, k);
+    }
+  ASSERT_EQ(gbt_size(dict), 0);
+  ASSERT_EQ(gbt_pop_max(dict, NULL, NULL), 0);
+  ASSERT(dict->t == NULL && dict->min == NULL && dict->max == NULL);
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
+/* Greatest height a tree of weight w may have */
+static long allowed_height(const size_t w) {
+  long h = 1;
+  while (h < GBT_MAXHEIGHT && gbt_minweight[h + 1] <= w)
+    h++;
+  return h;
+}
+
+/* Test GBT_MAXHEIGHT covers every weight that fits in memory */
+TEST general_balanced_tree_height_bound(void) {
+  gbt_InitGlobal();
+
+  /* the old hard-wired bound of 40 ran out before 10^9 keys */
+  ASSERT(allowed_height((size_t)1000000000UL + 1) > 40);
+  ASSERT(allowed_height((size_t)1000000000UL + 1) < GBT_MAXHEIGHT);
+
+  /* the node being inserted may sit one level below the allowed height */
+  ASSERT(allowed_height(GBT_SIZE_MAX / sizeof(struct gbt_node)) + 1 <=
+         GBT_MAXHEIGHT);
+  ASSERT_EQ(gbt_minweight[GBT_MAXHEIGHT], GBT_SIZE_MAX);
+  PASS();
+}
+
+/* Test depth and rebuilds stay within bounds for a million keys */
+TEST general_balanced_tree_scale(void) {
+  struct gbt_dict *const dict = gbt_construct_dict();
+  const unsigned long n = 1UL << 20;
+  unsigned long i;
+  ASSERT(dict != NULL);
+
+  for (i = 0; i < n; i++) /* sorted, through the append fast path */
+    gbt_append(dict, (gbt_ky_type)(2 * i), 0);
+  ASSERT_EQ(gbt_size(dict), n);
+  ASSERT(tree_height(dict->t) <= allowed_height(dict->weight));
+
+  for (i = 0; i < n; i++) /* scattered */
+    gbt_insert(dict, (gbt_ky_type)(((i * 2654435761UL) % n) * 2 + 1), 0);
+  ASSERT_EQ(gbt_size(dict), 2 * n);
+  ASSERT(tree_height(dict->t) <= allowed_height(dict->weight));
+  ASSERT(tree_is_valid(dict));
+
+  /* deleting nearly everything triggers a global rebuild */
+  for (i = 0; i < 2 * n - 1000; i++)
+    gbt_delete(dict, (gbt_ky_type)i);
+  ASSERT_EQ(gbt_size(dict), 1000);
+  ASSERT(dict->numofdeletions <= GBT_MAXDEL * dict->weight);
+  ASSERT(tree_height(dict->t) <= allowed_height(dict->weight));
+  ASSERT(tree_is_valid(dict));
+
+  gbt_destruct_dict(dict);
+  PASS();
+}
+
 SUITE(general_balanced_tree_c_suite) {
   RUN_TEST(general_balanced_tree_insert_lookup_size);
   RUN_TEST(general_balanced_tree_duplicate_insert);
@@ -195,6 +1047,26 @@ SUITE(general_balanced_tree_c_suite) {
   RUN_TEST(general_balanced_tree_clear);
   RUN_TEST(general_balanced_tree_perfect_balance);
   RUN_TEST(general_balanced_tree_large_insert_delete);
+  RUN_TEST(general_balanced_tree_insert_ex);
+  RUN_TEST(general_balanced_tree_upsert);
+  RUN_TEST(general_balanced_tree_get_or_insert);
+  RUN_TEST(general_balanced_tree_delete_get);
+  RUN_TEST(general_balanced_tree_cursor_insert_sorted);
+  RUN_TEST(general_balanced_tree_append);
+  RUN_TEST(general_balanced_tree_insert_next);
+  RUN_TEST(general_balanced_tree_foreach);
+  RUN_TEST(general_balanced_tree_lazy_delete);
+  RUN_TEST(general_balanced_tree_lazy_delete_purge);
+  RUN_TEST(general_balanced_tree_rebuild_kernels);
+  RUN_TEST(general_balanced_tree_min_max_pop);
+  RUN_TEST(general_balanced_tree_height_bound);
+  RUN_TEST(general_balanced_tree_scale);
+  RUN_TEST(general_balanced_tree_filter);
+  RUN_TEST(general_balanced_tree_cache);
+  RUN_TEST(general_balanced_tree_key_hashing);
+#ifdef GBT_AUGMENT
+  RUN_TEST(general_balanced_tree_aggregate_range);
+#endif /* GBT_AUGMENT */
 }
 
 #ifdef __cplusplus